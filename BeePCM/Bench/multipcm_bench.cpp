@@ -0,0 +1,264 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-Bench (MultiPCM)
+// Times the MultiPCM renderers against each other with all 28 slots playing,
+// and checks that the vector renderers produce the same output as the scalar one.
+// Also times a chip whose state is always in the cache against many chips rendered
+// in turn, which is what splitting each slot's state into hot and cold halves is for,
+// and compares those against the layout from before the split
+//
+// Usage: multipcm_bench [num_samples]
+
+#include <multipcm.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+using namespace beepcm;
+using namespace std;
+using namespace std::chrono;
+
+struct BenchResult
+{
+    double ns_per_sample = 0.0;
+    uint64_t output_hash = 0;
+};
+
+// Builds a ROM of 28 long looping samples with random sample data,
+// so that every slot stays busy for the whole run
+vector<uint8_t> make_rom()
+{
+    vector<uint8_t> rom(0x200000, 0);
+    uint32_t seed = 0x1234567;
+
+    auto next_rand = [&]() -> uint8_t
+    {
+	seed = ((seed * 1103515245) + 12345);
+	return (seed >> 16);
+    };
+
+    for (size_t i = 0x1000; i < rom.size(); i++)
+    {
+	rom[i] = next_rand();
+    }
+
+    for (int i = 0; i < 28; i++)
+    {
+	uint8_t *header = &rom[i * 12];
+	// Alternate between 8-bit and 12-bit samples
+	uint32_t start_addr = (0x1000 + (i * 0x10000)) | ((i & 1) ? 0x400000 : 0);
+	uint16_t loop_addr = 0x100;
+	uint16_t end_addr = (0x8000 + (i * 0x100));
+	header[0] = (start_addr >> 16);
+	header[1] = (start_addr >> 8);
+	header[2] = start_addr;
+	header[3] = (loop_addr >> 8);
+	header[4] = loop_addr;
+	header[5] = ((0xFFFF - end_addr) >> 8);
+	header[6] = (0xFFFF - end_addr);
+	header[7] = 0;
+	// Fast attack, slow decay to a sustain level, so that the envelopes keep changing
+	header[8] = 0xF2;
+	header[9] = 0x31;
+	header[10] = 0x05;
+	header[11] = 0;
+    }
+
+    return rom;
+}
+
+void write_slot(MultiPCM &chip, int slot_num, int reg, uint8_t data)
+{
+    chip.writeIO(1, (((slot_num / 7) * 8) + (slot_num % 7)));
+    chip.writeIO(2, reg);
+    chip.writeIO(0, data);
+}
+
+void init_chip(MultiPCM &chip, MultiPCMRenderer renderer, const vector<uint8_t> &rom, bool is_mirror_enabled)
+{
+    chip.set_renderer(renderer);
+    chip.writeROM(rom);
+    chip.enable_sample_mirror(is_mirror_enabled);
+    chip.get_sample_rate(10000000);
+    chip.init();
+
+    for (int slot = 0; slot < 28; slot++)
+    {
+	write_slot(chip, slot, 0, ((slot * 5) << 4));
+	write_slot(chip, slot, 1, slot);
+	write_slot(chip, slot, 2, (slot * 37));
+	write_slot(chip, slot, 3, (0x10 * ((slot % 5) + 5)) | (slot & 0x3));
+	write_slot(chip, slot, 5, ((slot * 8) << 1));
+	// Give a few of the slots vibrato and tremolo
+	write_slot(chip, slot, 6, ((slot % 4) == 0) ? 0x3A : 0);
+	write_slot(chip, slot, 7, ((slot % 6) == 0) ? 0x05 : 0);
+	write_slot(chip, slot, 4, 0x80);
+    }
+}
+
+// Renders num_samples samples from each of num_chips chips, one sample from each chip in turn
+// (the way a board with several chips is rendered), so that with enough chips
+// each chip's state has been evicted from the cache by the time it's clocked again
+BenchResult run_chips(MultiPCMRenderer renderer, const vector<uint8_t> &rom, int num_chips, bool is_mirror_enabled, int num_samples)
+{
+    vector<MultiPCM> chips(num_chips);
+
+    for (auto &chip : chips)
+    {
+	init_chip(chip, renderer, rom, is_mirror_enabled);
+    }
+
+    BenchResult result;
+    uint64_t hash = 1469598103934665603ULL;
+    int32_t samples[2];
+
+    auto start_time = steady_clock::now();
+
+    for (int i = 0; i < num_samples; i++)
+    {
+	for (auto &chip : chips)
+	{
+	    chip.clockchip();
+	    chip.get_samples(samples);
+	    hash = ((hash ^ uint32_t(samples[0])) * 1099511628211ULL);
+	    hash = ((hash ^ uint32_t(samples[1])) * 1099511628211ULL);
+	}
+    }
+
+    auto end_time = steady_clock::now();
+
+    result.ns_per_sample = (duration<double, nano>(end_time - start_time).count() / (double(num_samples) * num_chips));
+    result.output_hash = hash;
+    return result;
+}
+
+// Timings vary a lot between runs on a busy machine, so keep the fastest of several runs
+BenchResult run_fastest(MultiPCMRenderer renderer, const vector<uint8_t> &rom, int num_chips, bool is_mirror_enabled, int num_samples)
+{
+    const int num_runs = 5;
+    BenchResult fastest;
+
+    for (int run = 0; run < num_runs; run++)
+    {
+	BenchResult result = run_chips(renderer, rom, num_chips, is_mirror_enabled, num_samples);
+
+	if ((run == 0) || (result.ns_per_sample < fastest.ns_per_sample))
+	{
+	    fastest = result;
+	}
+    }
+
+    return fastest;
+}
+
+int main(int argc, char *argv[])
+{
+    int num_samples = 300000;
+
+    if (argc > 1)
+    {
+	num_samples = atoi(argv[1]);
+    }
+
+    vector<uint8_t> rom = make_rom();
+
+    struct RendererEntry
+    {
+	MultiPCMRenderer renderer;
+	string name;
+    };
+
+    vector<RendererEntry> renderers = {
+	{MultiPCMRenderer::Scalar, "Scalar"},
+	{MultiPCMRenderer::SSE2, "SSE2"},
+	{MultiPCMRenderer::AVX2, "AVX2"},
+    };
+
+    BenchResult scalar_result;
+    bool is_mismatch = false;
+
+    for (auto &entry : renderers)
+    {
+	BenchResult result;
+
+	try
+	{
+	    result = run_fastest(entry.renderer, rom, 1, false, num_samples);
+	}
+	catch (const exception &ex)
+	{
+	    printf("%-8s skipped (%s)\n", entry.name.c_str(), ex.what());
+	    continue;
+	}
+
+	if (entry.renderer == MultiPCMRenderer::Scalar)
+	{
+	    scalar_result = result;
+	}
+
+	bool is_match = (result.output_hash == scalar_result.output_hash);
+	is_mismatch |= !is_match;
+
+	printf("%-8s %8.2f ns/sample  %5.2fx  output %016llx %s\n",
+	    entry.name.c_str(),
+	    result.ns_per_sample,
+	    (scalar_result.ns_per_sample / result.ns_per_sample),
+	    (unsigned long long)result.output_hash,
+	    is_match ? "(matches scalar)" : "(DOES NOT MATCH SCALAR)");
+    }
+
+    // The cost of a chip's state not being in the cache,
+    // with the renderer that MultiPCM picks by default.
+    // Each setup is compared against the same setup with the slot layout from before
+    // each slot's state was split into hot and cold halves (when all of a slot's state was one struct).
+    // Those baselines (the fastest of 5 runs of the default number of samples) were measured on the test machine,
+    // so the ratios are only meaningful there
+    // (re-measure them by running this benchmark against the old layout on another machine)
+    struct ChipEntry
+    {
+	int num_chips;
+	bool is_mirror_enabled;
+	string name;
+	double baseline_ns;
+    };
+
+    vector<ChipEntry> chip_counts = {
+	{1, false, "1 chip", 186.0},
+	{1, true, "1 chip (sample mirror)", 213.4},
+	{8, false, "8 chips", 563.2},
+	{64, true, "64 chips (sample mirror)", 1539.8},
+    };
+
+    printf("\n");
+
+    for (auto &entry : chip_counts)
+    {
+	// Keep the total amount of work the same for every chip count
+	int chip_samples = max((num_samples / entry.num_chips), 1);
+	BenchResult result = run_fastest(MultiPCMRenderer::Auto, rom, entry.num_chips, entry.is_mirror_enabled, chip_samples);
+	printf("%-26s %8.2f ns/sample per chip  (unsplit layout: %8.2f ns, %5.2fx)\n",
+	    entry.name.c_str(),
+	    result.ns_per_sample,
+	    entry.baseline_ns,
+	    (entry.baseline_ns / result.ns_per_sample));
+    }
+
+    return is_mismatch ? 1 : 0;
+}
\ No newline at end of file
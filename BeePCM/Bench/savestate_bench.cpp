@@ -0,0 +1,161 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-Bench (Save states)
+// Times save_state(vector&) and load_state() for every core, which is what
+// run-ahead does every frame.
+//
+// Every core except the RF5C68/RF5C164 saves and loads in well under 1 us.
+// Those chips' states hold all 64 KB of wave RAM (along with the signed copy
+// and loop markers that have to be rebuilt from it on load), so they take
+// several microseconds instead (about 7 us to save and load on the test machine).
+//
+// Usage: savestate_bench [num_iterations]
+
+#include <segapcm.h>
+#include <ymz280b.h>
+#include <rf5c68.h>
+#include <multipcm.h>
+#include <upd7759.h>
+#include <okim6295.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+using namespace beepcm;
+using namespace std;
+using namespace std::chrono;
+
+vector<uint8_t> make_rom(size_t rom_size)
+{
+    vector<uint8_t> rom(rom_size, 0);
+
+    for (size_t i = 0; i < rom.size(); i++)
+    {
+	rom[i] = uint8_t((i * 131) >> 3);
+    }
+
+    return rom;
+}
+
+template<typename Chip>
+void clock_chip(Chip &chip)
+{
+    chip.clockchip();
+}
+
+void clock_chip(uPD7759 &chip)
+{
+    chip.clock_chip();
+}
+
+// Saves the chip's state twice (with some samples rendered in between, like two frames of run-ahead),
+// then times saving into a reused buffer and loading each of the two states in turn
+template<typename Chip>
+void bench_chip(const char *name, Chip &chip, int num_iterations)
+{
+    vector<uint8_t> first_state = chip.save_state();
+
+    for (int i = 0; i < 1000; i++)
+    {
+	clock_chip(chip);
+    }
+
+    vector<uint8_t> second_state = chip.save_state();
+    vector<uint8_t> state;
+    chip.save_state(state);
+
+    auto start_time = steady_clock::now();
+
+    for (int i = 0; i < num_iterations; i++)
+    {
+	chip.save_state(state);
+    }
+
+    auto save_time = steady_clock::now();
+
+    for (int i = 0; i < num_iterations; i++)
+    {
+	chip.load_state(((i & 1) != 0) ? second_state : first_state);
+    }
+
+    auto load_time = steady_clock::now();
+
+    double save_ns = (duration<double, nano>(save_time - start_time).count() / num_iterations);
+    double load_ns = (duration<double, nano>(load_time - save_time).count() / num_iterations);
+    printf("%-9s %6zu bytes  save %8.1f ns  load %8.1f ns\n", name, state.size(), save_ns, load_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_iterations = 20000;
+
+    if (argc > 1)
+    {
+	num_iterations = max(atoi(argv[1]), 1);
+    }
+
+    vector<uint8_t> rom = make_rom(0x1000000);
+
+    SegaPCM segapcm;
+    segapcm.writeROM(vector<uint8_t>(rom.begin(), (rom.begin() + 0x200000)));
+    segapcm.get_sample_rate(4000000);
+    segapcm.init();
+    bench_chip("SegaPCM", segapcm, num_iterations);
+
+    YMZ280B ymz280b;
+    ymz280b.writeROM(rom);
+    ymz280b.get_sample_rate(16934400);
+    ymz280b.init();
+
+    // Key on all eight voices
+    for (int voice = 0; voice < 8; voice++)
+    {
+	ymz280b.writeIO(0, (0x01 + (voice * 4)));
+	ymz280b.writeIO(1, 0xA0);
+	ymz280b.writeIO(0, (voice * 4));
+	ymz280b.writeIO(1, 0x40);
+    }
+
+    bench_chip("YMZ280B", ymz280b, num_iterations);
+
+    RF5C164 rf5c164;
+    rf5c164.get_sample_rate(12500000);
+    rf5c164.init();
+    rf5c164.writeRAM(0, 0x10000, vector<uint8_t>(rom.begin(), (rom.begin() + 0x10000)));
+    bench_chip("RF5C164", rf5c164, num_iterations);
+
+    MultiPCM multipcm;
+    multipcm.writeROM(vector<uint8_t>(rom.begin(), (rom.begin() + 0x400000)));
+    multipcm.get_sample_rate(8000000);
+    multipcm.init();
+    bench_chip("MultiPCM", multipcm, num_iterations);
+
+    uPD7759 upd7759;
+    upd7759.writeROM(vector<uint8_t>(rom.begin(), (rom.begin() + 0x20000)));
+    upd7759.get_sample_rate(640000);
+    upd7759.init();
+    bench_chip("uPD7759", upd7759, num_iterations);
+
+    OkiM6295 okim6295;
+    okim6295.writeROM(vector<uint8_t>(rom.begin(), (rom.begin() + 0x40000)));
+    okim6295.get_sample_rate(1000000);
+    okim6295.init();
+    bench_chip("OKIM6295", okim6295, num_iterations);
+
+    return 0;
+}
\ No newline at end of file
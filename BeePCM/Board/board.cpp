@@ -0,0 +1,202 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-Board
+//
+// Arcade boards often carry several sound chips (i.e. two MultiPCMs on Sega's Model 1,
+// or a SegaPCM and a uPD7759 on System 16), which don't affect each other
+// until their outputs are mixed together.
+//
+// Each chip has its own queue of timestamped writes, so each block of each chip
+// can be rendered on its own worker (stopping only to apply that chip's writes at the right sample),
+// with the outputs being mixed once every chip has finished the block.
+// This keeps the time taken to render a block close to that of the slowest chip on the board.
+
+#include "board.h"
+using namespace beepcm;
+
+namespace beepcm
+{
+    BoardRenderer::BoardRenderer(RenderPool &pool) : render_pool(pool)
+    {
+
+    }
+
+    BoardRenderer::~BoardRenderer()
+    {
+
+    }
+
+    int BoardRenderer::add_chip(boardrenderfunc render_func, boardwritefunc write_func, bool is_stereo, float gain, float pan)
+    {
+	auto chip = make_unique<board_chip>();
+	chip->render_func = render_func;
+	chip->write_func = write_func;
+	chip->is_stereo = is_stereo;
+	chip->mixer_input = mixer.add_input(is_stereo, gain, pan);
+	chips.push_back(move(chip));
+	return int(chips.size() - 1);
+    }
+
+    BoardRenderer::board_chip &BoardRenderer::get_chip(int chip)
+    {
+	if ((chip < 0) || (chip >= int(chips.size())))
+	{
+	    throw out_of_range("Invalid board chip");
+	}
+
+	return *chips[chip];
+    }
+
+    void BoardRenderer::queue_write(int chip, uint64_t timestamp, uint32_t addr, uint8_t data)
+    {
+	auto &writes = get_chip(chip).writes;
+
+	board_write write;
+	write.timestamp = timestamp;
+	write.addr = addr;
+	write.data = data;
+
+	// Writes are almost always queued in order, but keep the queue sorted if they aren't
+	// (with writes for the same sample staying in the order they were queued)
+	if (writes.empty() || (writes.back().timestamp <= timestamp))
+	{
+	    writes.push_back(write);
+	    return;
+	}
+
+	auto position = upper_bound(writes.begin(), writes.end(), timestamp, [](uint64_t time, const board_write &queued)
+	{
+	    return (time < queued.timestamp);
+	});
+
+	writes.insert(position, write);
+    }
+
+    uint64_t BoardRenderer::get_sample_count()
+    {
+	return sample_count;
+    }
+
+    Mixer &BoardRenderer::get_mixer()
+    {
+	return mixer;
+    }
+
+    // Renders the block in runs between each of the chip's writes
+    void BoardRenderer::render_chip(board_chip &chip, int num_frames)
+    {
+	int num_channels = chip.is_stereo ? 2 : 1;
+	int frame = 0;
+
+	while (true)
+	{
+	    uint64_t current_sample = (sample_count + frame);
+
+	    while (!chip.writes.empty() && (chip.writes.front().timestamp <= current_sample))
+	    {
+		auto &write = chip.writes.front();
+		chip.write_func(write.addr, write.data);
+		chip.writes.pop_front();
+	    }
+
+	    if (frame == num_frames)
+	    {
+		break;
+	    }
+
+	    int run_end = num_frames;
+
+	    if (!chip.writes.empty())
+	    {
+		uint64_t next_write = (chip.writes.front().timestamp - sample_count);
+		run_end = int(min<uint64_t>(next_write, num_frames));
+	    }
+
+	    chip.render_func(&chip.buffer[(frame * num_channels)], (run_end - frame));
+	    frame = run_end;
+	}
+    }
+
+    void BoardRenderer::render_block(int16_t *output, int num_frames)
+    {
+	for (auto &chip : chips)
+	{
+	    chip->buffer.resize(num_frames * (chip->is_stereo ? 2 : 1));
+	}
+
+	// Hand every chip but the first to the pool, and render the first one on this thread
+	vector<future<void>> pending_chips;
+
+	for (size_t i = 1; i < chips.size(); i++)
+	{
+	    board_chip &chip = *chips[i];
+
+	    pending_chips.push_back(render_pool.submit([this, &chip, num_frames](renderpool_scratch&)
+	    {
+		render_chip(chip, num_frames);
+	    }));
+	}
+
+	// Every chip has to finish before any exception is rethrown,
+	// as the workers are still using the chips until then
+	exception_ptr chip_error;
+
+	try
+	{
+	    if (!chips.empty())
+	    {
+		render_chip(*chips[0], num_frames);
+	    }
+	}
+	catch (...)
+	{
+	    chip_error = current_exception();
+	}
+
+	for (auto &pending : pending_chips)
+	{
+	    try
+	    {
+		pending.get();
+	    }
+	    catch (...)
+	    {
+		if (!chip_error)
+		{
+		    chip_error = current_exception();
+		}
+	    }
+	}
+
+	if (chip_error)
+	{
+	    rethrow_exception(chip_error);
+	}
+
+	mixer.begin_block(num_frames);
+
+	for (auto &chip : chips)
+	{
+	    mixer.mix_input(chip->mixer_input, chip->buffer.data());
+	}
+
+	mixer.end_block(output);
+	sample_count += num_frames;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,125 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEEPCM_BOARD
+#define BEEPCM_BOARD
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <future>
+#include "mixer.h"
+#include "renderpool.h"
+using namespace std;
+
+namespace beepcm
+{
+    // Renders num_frames frames of a chip into buffer
+    // (as interleaved left/right pairs for stereo chips)
+    using boardrenderfunc = function<void(int32_t*, int)>;
+
+    // Applies one queued write to a chip
+    using boardwritefunc = function<void(uint32_t, uint8_t)>;
+
+    // Renders all of the chips of one machine (at a common sample rate) in parallel,
+    // one chip per worker, and mixes them into a single 16-bit stereo stream
+    class BoardRenderer
+    {
+	public:
+	    BoardRenderer(RenderPool &pool);
+	    ~BoardRenderer();
+
+	    // Adds a chip to the board and returns its index (which is also its input number in get_mixer())
+	    int add_chip(boardrenderfunc render_func, boardwritefunc write_func, bool is_stereo, float gain = 1.0f, float pan = 0.0f);
+
+	    // Queues a write to a chip, to be applied just before the output sample numbered timestamp
+	    // (counting from the first sample ever rendered, with writes for past samples being applied immediately).
+	    // Must not be called while render_block() is running
+	    void queue_write(int chip, uint64_t timestamp, uint32_t addr, uint8_t data);
+
+	    // Renders the next num_frames frames of every chip, and mixes them into output
+	    // (as interleaved left/right pairs).
+	    // The calling thread renders one of the chips itself, so this must not be called from inside a pool job
+	    void render_block(int16_t *output, int num_frames);
+
+	    uint64_t get_sample_count();
+
+	    Mixer &get_mixer();
+
+	    // Render function for any core that has clockchip() and get_samples(int32_t*)
+	    // (which writes into the stack rather than allocating for every sample)
+	    template<typename T>
+	    static boardrenderfunc clocked_render(T &chip, bool is_stereo)
+	    {
+		return [&chip, is_stereo](int32_t *buffer, int num_frames)
+		{
+		    for (int i = 0; i < num_frames; i++)
+		    {
+			// Mono chips only write samples[0]
+			int32_t samples[2] = {0, 0};
+			chip.clockchip();
+			chip.get_samples(samples);
+
+			if (is_stereo)
+			{
+			    buffer[(i * 2)] = samples[0];
+			    buffer[(i * 2) + 1] = samples[1];
+			}
+			else
+			{
+			    buffer[i] = samples[0];
+			}
+		    }
+		};
+	    }
+
+	private:
+	    struct board_write
+	    {
+		uint64_t timestamp = 0;
+		uint32_t addr = 0;
+		uint8_t data = 0;
+	    };
+
+	    // Each chip is allocated separately, so that workers rendering
+	    // neighbouring chips don't write to the same cache lines
+	    struct alignas(64) board_chip
+	    {
+		boardrenderfunc render_func;
+		boardwritefunc write_func;
+		bool is_stereo = false;
+		int mixer_input = 0;
+		deque<board_write> writes;
+		vector<int32_t> buffer;
+	    };
+
+	    RenderPool &render_pool;
+	    Mixer mixer;
+	    vector<unique_ptr<board_chip>> chips;
+	    uint64_t sample_count = 0;
+
+	    board_chip &get_chip(int chip);
+	    void render_chip(board_chip &chip, int num_frames);
+    };
+};
+
+#endif // BEEPCM_BOARD
\ No newline at end of file
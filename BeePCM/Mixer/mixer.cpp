@@ -0,0 +1,132 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-Mixer
+//
+// Every chip core outputs its own kind of samples (mono or stereo, clamped per voice or not at all),
+// so this combines blocks from several of them into one output stream.
+//
+// Each input is scaled and added into a single floating-point accumulator,
+// which is only clamped to 16 bits once all of the inputs have been added.
+// All of the loops below are kept simple enough for the compiler to vectorize.
+
+#include "mixer.h"
+using namespace beepcm;
+
+namespace beepcm
+{
+    Mixer::Mixer()
+    {
+
+    }
+
+    Mixer::~Mixer()
+    {
+
+    }
+
+    int Mixer::add_input(bool is_stereo, float gain, float pan)
+    {
+	mixer_input input;
+	input.is_stereo = is_stereo;
+	input.gain = gain;
+	inputs.push_back(input);
+
+	// The pan goes through set_pan(), so it's clamped the same way
+	int input_num = int(inputs.size() - 1);
+	set_pan(input_num, pan);
+	return input_num;
+    }
+
+    Mixer::mixer_input &Mixer::get_input(int input)
+    {
+	if ((input < 0) || (input >= int(inputs.size())))
+	{
+	    throw out_of_range("Invalid mixer input");
+	}
+
+	return inputs[input];
+    }
+
+    void Mixer::set_gain(int input, float gain)
+    {
+	auto &mix_input = get_input(input);
+	mix_input.gain = gain;
+	calc_gains(mix_input);
+    }
+
+    void Mixer::set_pan(int input, float pan)
+    {
+	auto &mix_input = get_input(input);
+	mix_input.pan = clamp(pan, -1.0f, 1.0f);
+	calc_gains(mix_input);
+    }
+
+    // Panning only ever turns down the opposite side,
+    // so a centered input is mixed in at its full gain
+    void Mixer::calc_gains(mixer_input &input)
+    {
+	input.left_gain = (input.gain * min(1.0f, (1.0f - input.pan)));
+	input.right_gain = (input.gain * min(1.0f, (1.0f + input.pan)));
+    }
+
+    void Mixer::begin_block(int num_samples)
+    {
+	block_samples = max(num_samples, 0);
+	accumulator.assign((block_samples * 2), 0.0f);
+    }
+
+    void Mixer::mix_input(int input, const int32_t *samples)
+    {
+	auto &mix_input = get_input(input);
+	float left_gain = mix_input.left_gain;
+	float right_gain = mix_input.right_gain;
+	float *mix_buffer = accumulator.data();
+
+	if (mix_input.is_stereo)
+	{
+	    for (int index = 0; index < block_samples; index++)
+	    {
+		mix_buffer[(index * 2)] += (float(samples[(index * 2)]) * left_gain);
+		mix_buffer[(index * 2) + 1] += (float(samples[(index * 2) + 1]) * right_gain);
+	    }
+	}
+	else
+	{
+	    for (int index = 0; index < block_samples; index++)
+	    {
+		float sample = float(samples[index]);
+		mix_buffer[(index * 2)] += (sample * left_gain);
+		mix_buffer[(index * 2) + 1] += (sample * right_gain);
+	    }
+	}
+    }
+
+    void Mixer::end_block(int16_t *output)
+    {
+	const float *mix_buffer = accumulator.data();
+
+	// Clamping before the conversion keeps it in range,
+	// and unity gain inputs come out unchanged
+	for (int index = 0; index < (block_samples * 2); index++)
+	{
+	    float sample = min(max(mix_buffer[index], -32768.0f), 32767.0f);
+	    output[index] = int16_t(int32_t(sample));
+	}
+    }
+};
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEEPCM_MIXER
+#define BEEPCM_MIXER
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+namespace beepcm
+{
+    // Mixes blocks of samples from any number of chips into one 16-bit stereo stream,
+    // summing everything at full precision and only saturating the final result
+    class Mixer
+    {
+	public:
+	    Mixer();
+	    ~Mixer();
+
+	    // Adds an input to the mix and returns its index
+	    // (mono inputs are sent to both output channels)
+	    int add_input(bool is_stereo, float gain = 1.0f, float pan = 0.0f);
+
+	    void set_gain(int input, float gain);
+
+	    // Pans (or balances, for stereo inputs) an input from -1.0 (left) to 1.0 (right)
+	    void set_pan(int input, float pan);
+
+	    // Starts mixing a new block of num_samples samples
+	    void begin_block(int num_samples);
+
+	    // Adds a block of samples from an input to the mix
+	    // (stereo inputs are interleaved left/right pairs)
+	    void mix_input(int input, const int32_t *samples);
+
+	    // Saturates the mixed block into output (as interleaved left/right pairs)
+	    void end_block(int16_t *output);
+
+	private:
+	    struct mixer_input
+	    {
+		bool is_stereo = false;
+		float gain = 1.0f;
+		float pan = 0.0f;
+		float left_gain = 1.0f;
+		float right_gain = 1.0f;
+	    };
+
+	    vector<mixer_input> inputs;
+
+	    // Running sum of the current block, as interleaved left/right pairs
+	    vector<float> accumulator;
+	    int block_samples = 0;
+
+	    mixer_input &get_input(int input);
+	    void calc_gains(mixer_input &input);
+    };
+};
+
+#endif // BEEPCM_MIXER
\ No newline at end of file
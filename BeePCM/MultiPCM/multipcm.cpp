@@ -27,22 +27,63 @@
 //
 // BueniaDev's Notes:
 //
-// Though this core is slowly approaching completion, the following features are still
-// completely unimplemented:
-//
-// LFO/Vibrato/Tremolo
-//
-// In addition, the 12-bit linear PCM sound generation has not been thoroughly tested as of yet.
+// Though this core is slowly approaching completion, the LFO/Vibrato/Tremolo and
+// 12-bit linear PCM sound generation have not been thoroughly tested as of yet.
 // However, work will be done on all of those fronts, so don't lose hope here!
 
 #include "multipcm.h"
 using namespace beepcm;
 
+// The vector renderers are built for SSE2 wherever it's part of the baseline instruction set,
+// and for AVX2 (picked at runtime) where the compiler can build single functions for it
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define BEEPCM_MULTIPCM_SSE2
+
+#if defined(__GNUC__)
+#define BEEPCM_MULTIPCM_AVX2
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define BEEPCM_MULTIPCM_INLINE __attribute__((always_inline))
+#else
+#define BEEPCM_MULTIPCM_INLINE
+#endif
+
 namespace beepcm
 {
-    MultiPCM::MultiPCM()
+    struct MultiPCM::multipcm_tables
+    {
+	array<array<int32_t, 0x800>, 2> m_pan_table;
+	array<int32_t, 2> tll_steps;
+	array<uint32_t, 0x40> attack_steps;
+	array<uint32_t, 0x40> decay_steps;
+	array<int32_t, 0x400> volume_table;
+	array<int32_t, 0x100> pitch_lfo_wave;
+	array<int32_t, 0x100> amp_lfo_wave;
+	array<array<int32_t, 0x100>, 8> pitch_lfo_scales;
+	array<array<int32_t, 0x100>, 8> amp_lfo_scales;
+    };
+
+    // Everything that is stepped once per output sample,
+    // scaled from the chip's own sample rate to the output rate
+    struct MultiPCM::multipcm_rate_tables
     {
+	array<array<uint32_t, 0x400>, 0x10> pitch_steps;
+	array<uint32_t, 8> lfo_phase_steps;
+	array<int32_t, 2> tll_steps;
+	array<uint32_t, 0x40> attack_steps;
+	array<uint32_t, 0x40> decay_steps;
+    };
 
+    MultiPCM::MultiPCM()
+    {
+	tables = &get_tables();
+	rate_tables = get_rate_tables(0, 0);
+	decode_sample_headers(0, (sample_headers.size() * 12));
+	lanes.amp_lfo_value.fill(1 << 12);
+	set_renderer(MultiPCMRenderer::Auto);
     }
 
     MultiPCM::~MultiPCM()
@@ -50,110 +91,247 @@ namespace beepcm
 
     }
 
-    void MultiPCM::init_tables()
+    // Built once on first use, as none of these depend on the chip's sample rate
+    const MultiPCM::multipcm_tables &MultiPCM::get_tables()
     {
-	for (int i = 0; i < 0x400; i++)
+	static const multipcm_tables shared_tables = []() -> multipcm_tables
 	{
-	    float fcent = (float(chip_sample_rate) * (1024.f + float(i)) / 1024.f);
-	    freq_step_table.at(i) = uint32_t(float(1 << 12) * fcent);
-	}
+	    multipcm_tables tables;
 
-	for (int level = 0; level < 0x80; level++)
-	{
-	    float vol_db = ((float(level) * -24.f) / 64.f);
-	    float total_level = (powf(10.f, (vol_db / 20.f)) / 4.f);
+	    for (int level = 0; level < 0x80; level++)
+	    {
+		float vol_db = ((float(level) * -24.f) / 64.f);
+		float total_level = (powf(10.f, (vol_db / 20.f)) / 4.f);
+
+		for (int pan = 0; pan < 0x10; pan++)
+		{
+		    float pan_left = 0.0f;
+		    float pan_right = 0.0f;
+
+		    if (pan == 8)
+		    {
+			pan_left = 0.0f;
+			pan_right = 0.0f;
+		    }
+		    else if (pan == 0)
+		    {
+			pan_left = 1.0f;
+			pan_right = 1.0f;
+		    }
+		    else if ((pan & 0x8) != 0)
+		    {
+			pan_left = 1.0f;
+			int32_t inverted_pan = (0x10 - pan);
+			float pan_vol_db = (float(inverted_pan) * -12.f / 4.f);
+
+			pan_right = pow(10.f, (pan_vol_db / 20.f));
+
+			if ((inverted_pan & 0x7) == 7)
+			{
+			    pan_right = 0;
+			}
+		    }
+		    else
+		    {
+			pan_right = 1.0f;
+			float pan_vol_db = (float(pan) * -12.f / 4.f);
+
+			pan_left = pow(10.f, (pan_vol_db / 20.f));
 
-	    for (int pan = 0; pan < 0x10; pan++)
+			if ((pan & 0x7) == 0x7)
+			{
+			    pan_left = 0;
+			}
+		    }
+
+		    int pan_table_offs = ((pan << 7) | level);
+		    tables.m_pan_table[0][pan_table_offs] = int32_t(float(1 << 12) * (pan_left * total_level));
+		    tables.m_pan_table[1][pan_table_offs] = int32_t(float(1 << 12) * (pan_right * total_level));
+		}
+	    }
+
+	    float numerator_tll = float(0x80 << 12);
+	    tables.tll_steps[0] = (-numerator_tll / (78.2f * 44100.f / 1000.f)); // Lower TLL
+	    tables.tll_steps[1] = (numerator_tll / (78.2f * 2 * 44100.f / 1000.f)); // Raise TLL
+
+	    array<double, 64> base_times = 
+	    {
+		0,       0,       0,       0,
+		6222.95, 4978.37, 4148.66, 3556.01,
+		3111.47, 2489.21, 2074.33, 1778.00,
+		1555.74, 1244.63, 1037.19, 889.02,
+		777.87,  622.31,  518.59,  444.54,
+		388.93,  311.16,  259.32,  222.27,
+		194.47,  155.60,  129.66,  111.16,
+		97.23,   77.82,   64.85,   55.60,
+		48.62,   38.91,   32.43,   27.80,
+		24.31,   19.46,   16.24,   13.92,
+		12.15,   9.75,    8.12,    6.98,
+		6.08,    4.90,    4.08,    3.49,
+		3.04,    2.49,    2.13,    1.90,
+		1.72,    1.41,    1.18,    1.04,
+		0.91,    0.73,    0.59,    0.50,
+		0.45,    0.45,    0.45,    0.45
+	    };
+
+	    for (int i = 4 ; i < 0x40; i++)
+	    {
+		tables.attack_steps[i] = float(0x400 << 16) / float(base_times[i] * 44100.f / 1000.f);
+		tables.decay_steps[i] = float(0x400 << 16) / float(base_times[i] * 14.32833 * 44100.f / 1000.f);
+	    }
+
+	    for (int i = 0; i < 4; i++)
+	    {
+		tables.attack_steps[i] = 0;
+		tables.decay_steps[i] = 0;
+	    }
+
+	    tables.attack_steps[0x3F] = (0x400 << 16);
+
+	    for (int i = 0; i < 0x400; i++)
 	    {
-		float pan_left = 0.0f;
-		float pan_right = 0.0f;
+		float db = -(96.f - (96.f * float(i) / float(0x400)));
+		float exp_volume = powf(10.f, (db / 20.f));
+		tables.volume_table[i] = uint32_t(float(1 << 12) * exp_volume);
+	    }
+
+	    // LFO waveforms (triangle waves, with the pitch LFO centered on 0)
+	    for (int i = 0; i < 0x100; i++)
+	    {
+		if (i < 0x80)
+		{
+		    tables.amp_lfo_wave[i] = (255 - (i * 2));
+		}
+		else
+		{
+		    tables.amp_lfo_wave[i] = ((i * 2) - 256);
+		}
 
-		if (pan == 8)
+		if (i < 0x40)
 		{
-		    pan_left = 0.0f;
-		    pan_right = 0.0f;
+		    tables.pitch_lfo_wave[i] = (i * 2);
 		}
-		else if (pan == 0)
+		else if (i < 0x80)
 		{
-		    pan_left = 1.0f;
-		    pan_right = 1.0f;
+		    tables.pitch_lfo_wave[i] = (255 - (i * 2));
 		}
-		else if (testbit(pan, 3))
+		else if (i < 0xC0)
 		{
-		    pan_left = 1.0f;
-		    int32_t inverted_pan = (0x10 - pan);
-		    float pan_vol_db = (float(inverted_pan) * -12.f / 4.f);
+		    tables.pitch_lfo_wave[i] = (256 - (i * 2));
+		}
+		else
+		{
+		    tables.pitch_lfo_wave[i] = ((i * 2) - 511);
+		}
+	    }
 
-		    pan_right = pow(10.f, (pan_vol_db / 20.f));
+	    // Maximum depth of each LFO scale setting (in cents for the pitch LFO, and in dB for the amplitude LFO)
+	    array<float, 8> pitch_scale_limits = {0.0, 3.378, 5.065, 6.750, 10.114, 20.170, 40.180, 79.307};
+	    array<float, 8> amp_scale_limits = {0.0, 0.4, 0.8, 1.5, 3.0, 6.0, 12.0, 24.0};
 
-		    if ((inverted_pan & 0x7) == 7)
-		    {
-			pan_right = 0;
-		    }
+	    for (int scale = 0; scale < 8; scale++)
+	    {
+		for (int i = -128; i < 128; i++)
+		{
+		    float cents = ((pitch_scale_limits[scale] * float(i)) / 128.f);
+		    tables.pitch_lfo_scales[scale][i + 128] = uint32_t(float(1 << 8) * powf(2.f, (cents / 1200.f)));
 		}
-		else
+
+		for (int i = 0; i < 0x100; i++)
 		{
-		    pan_right = 1.0f;
-		    float pan_vol_db = (float(pan) * -12.f / 4.f);
+		    float vol_db = ((-amp_scale_limits[scale] * float(i)) / 256.f);
+		    tables.amp_lfo_scales[scale][i] = uint32_t(float(1 << 8) * powf(10.f, (vol_db / 20.f)));
+		}
+	    }
+
+	    return tables;
+	}();
+
+	return shared_tables;
+    }
+
+    // The step tables depend on the sample rate and output rate,
+    // so one copy is kept per pair of rates for the lifetime of the process
+    // (a sample rate of 0 gives all-zero pitch and LFO tables, which keep the slots still until the clock is configured)
+    const MultiPCM::multipcm_rate_tables *MultiPCM::get_rate_tables(uint32_t sample_rate, uint32_t output_rate)
+    {
+	static mutex cache_mutex;
+	static map<pair<uint32_t, uint32_t>, unique_ptr<multipcm_rate_tables>> cached_tables;
 
-		    pan_left = pow(10.f, (pan_vol_db / 20.f));
+	lock_guard<mutex> lock(cache_mutex);
 
-		    if ((pan & 0x7) == 0x7)
+	auto &rate_table = cached_tables[{sample_rate, output_rate}];
+
+	if (!rate_table)
+	{
+	    rate_table = make_unique<multipcm_rate_tables>();
+	    const multipcm_tables &base_tables = get_tables();
+
+	    if (sample_rate == 0)
+	    {
+		rate_table->pitch_steps = {};
+		rate_table->lfo_phase_steps = {};
+		rate_table->tll_steps = base_tables.tll_steps;
+		rate_table->attack_steps = base_tables.attack_steps;
+		rate_table->decay_steps = base_tables.decay_steps;
+		return rate_table.get();
+	    }
+
+	    // Converts a per-sample step at the chip's own rate into one per output sample
+	    auto scale_step = [&](int64_t step) -> int64_t
+	    {
+		return ((step * sample_rate) / output_rate);
+	    };
+
+	    // Sample position step for every octave and pitch register value
+	    for (int i = 0; i < 0x400; i++)
+	    {
+		float fcent = (float(sample_rate) * (1024.f + float(i)) / 1024.f);
+		uint32_t freq_step = uint32_t(float(1 << 12) * fcent);
+
+		for (uint32_t octave = 0; octave < 0x10; octave++)
+		{
+		    uint32_t pitch = freq_step;
+
+		    if ((octave & 0x8) != 0)
+		    {
+			pitch >>= (16 - octave);
+		    }
+		    else
 		    {
-			pan_left = 0;
+			pitch <<= octave;
 		    }
+
+		    rate_table->pitch_steps[octave][i] = scale_step(pitch / sample_rate);
 		}
+	    }
 
-		int pan_table_offs = ((pan << 7) | level);
-		m_pan_table[0][pan_table_offs] = int32_t(float(1 << 12) * (pan_left * total_level));
-		m_pan_table[1][pan_table_offs] = int32_t(float(1 << 12) * (pan_right * total_level));
-	    }
-	}
-
-	float numerator_tll = float(0x80 << 12);
-	tll_steps[0] = (-numerator_tll / (78.2f * 44100.f / 1000.f)); // Lower TLL
-	tll_steps[1] = (numerator_tll / (78.2f * 2 * 44100.f / 1000.f)); // Raise TLL
-
-	array<double, 64> base_times = 
-	{
-	    0,       0,       0,       0,
-	    6222.95, 4978.37, 4148.66, 3556.01,
-	    3111.47, 2489.21, 2074.33, 1778.00,
-	    1555.74, 1244.63, 1037.19, 889.02,
-	    777.87,  622.31,  518.59,  444.54,
-	    388.93,  311.16,  259.32,  222.27,
-	    194.47,  155.60,  129.66,  111.16,
-	    97.23,   77.82,   64.85,   55.60,
-	    48.62,   38.91,   32.43,   27.80,
-	    24.31,   19.46,   16.24,   13.92,
-	    12.15,   9.75,    8.12,    6.98,
-	    6.08,    4.90,    4.08,    3.49,
-	    3.04,    2.49,    2.13,    1.90,
-	    1.72,    1.41,    1.18,    1.04,
-	    0.91,    0.73,    0.59,    0.50,
-	    0.45,    0.45,    0.45,    0.45
-	};
+	    // LFO frequencies (in Hz)
+	    array<float, 8> lfo_freqs = {0.168, 2.019, 3.196, 4.206, 5.215, 5.888, 6.224, 7.066};
 
-	for (int i = 4 ; i < 0x40; i++)
-	{
-	    attack_steps[i] = float(0x400 << 16) / float(base_times[i] * 44100.f / 1000.f);
-	    decay_steps[i] = float(0x400 << 16) / float(base_times[i] * 14.32833 * 44100.f / 1000.f);
-	}
+	    for (int i = 0; i < 8; i++)
+	    {
+		float step = (lfo_freqs[i] * 256.f / float(output_rate));
+		rate_table->lfo_phase_steps.at(i) = uint32_t(float(1 << 8) * step);
+	    }
 
-	for (int i = 0; i < 4; i++)
-	{
-	    attack_steps[i] = 0;
-	    decay_steps[i] = 0;
-	}
+	    // Envelopes and total level changes keep their timing,
+	    // apart from the fastest attack rate (which is always instant)
+	    for (int i = 0; i < 2; i++)
+	    {
+		rate_table->tll_steps[i] = scale_step(base_tables.tll_steps[i]);
+	    }
 
-	attack_steps[0x3F] = (0x400 << 16);
+	    for (int i = 0; i < 0x40; i++)
+	    {
+		rate_table->attack_steps[i] = scale_step(base_tables.attack_steps[i]);
+		rate_table->decay_steps[i] = scale_step(base_tables.decay_steps[i]);
+	    }
 
-	for (int i = 0; i < 0x400; i++)
-	{
-	    float db = -(96.f - (96.f * float(i) / float(0x400)));
-	    float exp_volume = powf(10.f, (db / 20.f));
-	    volume_table[i] = uint32_t(float(1 << 12) * exp_volume);
+	    rate_table->attack_steps[0x3F] = base_tables.attack_steps[0x3F];
 	}
+
+	return rate_table.get();
     }
 
     int MultiPCM::value_to_channel(int val)
@@ -169,33 +347,122 @@ namespace beepcm
 	return ch_map[(val & 0x1F)];
     }
 
-    uint8_t MultiPCM::read_rom(uint32_t addr)
+    inline BEEPCM_MULTIPCM_INLINE uint8_t MultiPCM::read_rom(uint32_t addr)
     {
 	return (addr < multipcm_rom.size()) ? multipcm_rom.at(addr) : 0;
     }
 
-    void MultiPCM::init_sample(multipcm_channel &channel)
+    // Re-decodes every sample header that overlaps the given ROM range
+    void MultiPCM::decode_sample_headers(uint32_t start, uint32_t length)
+    {
+	uint32_t header_area = (sample_headers.size() * 12);
+
+	if ((length == 0) || (start >= header_area))
+	{
+	    return;
+	}
+
+	uint32_t first_header = (start / 12);
+	uint32_t last_header = (min<uint32_t>((start + length), header_area) - 1) / 12;
+
+	for (uint32_t index = first_header; index <= last_header; index++)
+	{
+	    multipcm_data &header = sample_headers[index];
+	    uint32_t address = (index * 12);
+	    uint32_t start_addr = ((read_rom(address) << 16) | (read_rom(address + 1) << 8) | read_rom(address + 2));
+	    header.format = ((start_addr >> 20) & 0xFE);
+	    header.start_addr = (start_addr & 0x3FFFFF);
+	    header.loop_addr = ((read_rom(address + 3) << 8) | read_rom(address + 4));
+	    header.end_addr = (0xFFFF - ((read_rom(address + 5) << 8) | read_rom(address + 6)));
+
+	    header.attack_rate = (read_rom(address + 8) >> 4);
+	    header.decay_rate = (read_rom(address + 8) & 0xF);
+	    header.decay2_rate = (read_rom(address + 9) & 0xF);
+	    header.decay_level = (read_rom(address + 9) >> 4);
+	    header.release_rate = (read_rom(address + 10) & 0xF);
+	    header.key_rate_scale = (read_rom(address + 10) >> 4);
+	}
+    }
+
+    void MultiPCM::init_sample(int slot_num)
     {
-	uint32_t address = (channel.sample_index * 12);
-	uint32_t start_addr = ((read_rom(address) << 16) | (read_rom(address + 1) << 8) | read_rom(address + 2));
-	channel.metadata.format = ((start_addr >> 20) & 0xFE);
-	channel.metadata.start_addr = (start_addr & 0x3FFFFF);
-	channel.metadata.loop_addr = ((read_rom(address + 3) << 8) | read_rom(address + 4));
-	channel.metadata.end_addr = (0xFFFF - ((read_rom(address + 5) << 8) | read_rom(address + 6)));
+	auto &channel = channels[slot_num];
+	auto &slot = slots[slot_num];
+	slot.metadata = sample_headers[slot.sample_index];
+	channel.format = slot.metadata.format;
+	channel.base_addr = slot.metadata.start_addr;
+	channel.loop_addr = slot.metadata.loop_addr;
+	channel.end_addr = slot.metadata.end_addr;
+	channel.sample_mirror = nullptr;
+	lanes.loop_offset[slot_num] = (channel.loop_addr << 12);
+	lanes.end_offset[slot_num] = (channel.end_addr << 12);
+    }
+
+    inline BEEPCM_MULTIPCM_INLINE int16_t MultiPCM::fetch_sample(uint32_t base_addr, uint32_t format, uint32_t spos)
+    {
+	if (testbit(format, 3))
+	{
+	    uint32_t addr = (base_addr + (spos >> 2) * 6);
+
+	    // Each group of four samples is packed into 6 bytes
+	    // (ab.c .... ...., ..C. AB.. ...., .... ..ab .c.., .... .... C.AB),
+	    // so look up where the sample's bytes are rather than branching on its position
+	    static constexpr array<uint8_t, 4> high_offs = {0, 2, 3, 5};
+	    static constexpr array<uint8_t, 4> nibble_offs = {1, 1, 4, 4};
+
+	    uint32_t sample_num = (spos & 3);
+	    uint8_t nibble = read_rom(addr + nibble_offs[sample_num]);
+
+	    // Even samples use the low nibble, odd samples use the high nibble
+	    nibble = ((nibble << (4 * (~sample_num & 1))) & 0xF0);
+	    return ((read_rom(addr + high_offs[sample_num]) << 8) | nibble);
+	}
+
+	return int16_t(read_rom(base_addr + spos) << 8);
+    }
+
+    // Returns an unpacked copy of the channel's sample region,
+    // growing the cached copy if this channel plays further into it
+    const vector<int16_t> *MultiPCM::get_sample_mirror(multipcm_channel &channel)
+    {
+	uint32_t mirror_key = (channel.base_addr | (uint32_t(testbit(channel.format, 3)) << 31));
+	auto &mirror = sample_mirrors[mirror_key];
+
+	// The sample position never passes the end address, or the loop address after a wrap
+	uint32_t length = max<uint32_t>(channel.end_addr, (channel.loop_addr + 1));
+
+	for (uint32_t spos = mirror.size(); spos < length; spos++)
+	{
+	    mirror.push_back(fetch_sample(channel.base_addr, channel.format, spos));
+	}
+
+	return &mirror;
+    }
+
+    void MultiPCM::clear_sample_mirrors()
+    {
+	sample_mirrors.clear();
+
+	for (auto &channel : channels)
+	{
+	    channel.sample_mirror = nullptr;
+	}
+    }
 
-	channel.metadata.attack_rate = (read_rom(address + 8) >> 4);
-	channel.metadata.decay_rate = (read_rom(address + 8) & 0xF);
-	channel.metadata.decay2_rate = (read_rom(address + 9) & 0xF);
-	channel.metadata.decay_level = (read_rom(address + 9) >> 4);
-	channel.metadata.release_rate = (read_rom(address + 10) & 0xF);
-	channel.metadata.key_rate_scale = (read_rom(address + 10) >> 4);
+    void MultiPCM::enable_sample_mirror(bool is_enabled)
+    {
+	is_mirror_enabled = is_enabled;
+	clear_sample_mirrors();
     }
 
-    void MultiPCM::retrigger_sample(multipcm_channel &channel)
+    void MultiPCM::retrigger_sample(int slot_num)
     {
-	channel.offset = 0;
-	channel.prev_sample = 0;
-	channel.tll_val = (channel.total_level << 12);
+	auto &channel = channels[slot_num];
+	auto &slot = slots[slot_num];
+	lanes.offset[slot_num] = 0;
+	lanes.prev_sample[slot_num] = 0;
+	lanes.tll_val[slot_num] = (lanes.total_level[slot_num] << 12);
+	channel.sample_mirror = nullptr;
 
 	if ((chip_bank != 0) && (channel.base_addr >= 0x100000))
 	{
@@ -203,87 +470,222 @@ namespace beepcm
 	    channel.base_addr |= chip_bank;
 	}
 
-	calc_env_rate(channel);
-	channel.env_state = multipcm_env_state::Attack;
-	channel.env_volume = 0;
+	calc_env_rate(slot);
+	slot.env_state = multipcm_env_state::Attack;
+	lanes.env_volume[slot_num] = 0;
+	lanes.env_samples_left[slot_num] = 0;
     }
 
-    void MultiPCM::env_update(multipcm_channel &channel)
+    inline void MultiPCM::env_update(int slot_num)
     {
-	switch (channel.env_state)
+	auto &slot = slots[slot_num];
+	auto &env_volume = lanes.env_volume[slot_num];
+	auto &final_volume = lanes.final_volume[slot_num];
+
+	switch (slot.env_state)
 	{
 	    case multipcm_env_state::Attack:
 	    {
-		channel.env_volume += channel.attack_rate;
+		env_volume += slot.attack_rate;
 
-		if (channel.env_volume >= (0x3FF << 16))
+		if (env_volume >= (0x3FF << 16))
 		{
-		    channel.env_state = multipcm_env_state::Decay1;
+		    slot.env_state = multipcm_env_state::Decay1;
 
-		    if (channel.decay_rate >= (0x400 << 16))
+		    if (slot.decay_rate >= (0x400 << 16))
 		    {
-			channel.env_state = multipcm_env_state::Decay2;
+			slot.env_state = multipcm_env_state::Decay2;
 		    }
 
-		    channel.env_volume = (0x3FF << 16);
+		    env_volume = (0x3FF << 16);
 		}
 
-		channel.final_volume = volume_table[channel.env_volume >> 16];
+		final_volume = tables->volume_table[env_volume >> 16];
 	    }
 	    break;
 	    case multipcm_env_state::Decay1:
 	    {
-		channel.env_volume -= channel.decay_rate;
+		env_volume -= slot.decay_rate;
 
-		if (channel.env_volume <= 0)
+		if (env_volume <= 0)
 		{
-		    channel.env_volume = 0;
+		    env_volume = 0;
 		}
 
-		if ((channel.env_volume >> 16) <= (channel.decay_level << 6))
+		if ((env_volume >> 16) <= (slot.decay_level << 6))
 		{
-		    channel.env_state = multipcm_env_state::Decay2;
+		    slot.env_state = multipcm_env_state::Decay2;
 		}
 
-		channel.final_volume = volume_table[channel.env_volume >> 16];
+		final_volume = tables->volume_table[env_volume >> 16];
 	    }
 	    break;
 	    case multipcm_env_state::Decay2:
 	    {
-		channel.env_volume -= channel.decay2_rate;
+		env_volume -= slot.decay2_rate;
 
-		if (channel.env_volume <= 0)
+		if (env_volume <= 0)
 		{
-		    channel.env_volume = 0;
+		    env_volume = 0;
 		}
 
-		channel.final_volume = volume_table[channel.env_volume >> 16];
+		final_volume = tables->volume_table[env_volume >> 16];
 	    }
 	    break;
 	    case multipcm_env_state::Release:
 	    {
-		channel.env_volume -= channel.release_rate;
+		env_volume -= slot.release_rate;
 
-		if (channel.env_volume <= 0)
+		if (env_volume <= 0)
 		{
-		    channel.env_volume = 0;
-		    channel.is_playing = false;
+		    env_volume = 0;
+		    set_playing(slot_num, false);
 		}
 
-		channel.final_volume = volume_table[channel.env_volume >> 16];
+		final_volume = tables->volume_table[env_volume >> 16];
+	    }
+	    break;
+	    default:
+	    {
+		final_volume = (1 << 12);
+	    }
+	    break;
+	}
+    }
+
+    // Works out how many of the following samples only move the envelope in a straight line,
+    // so that clockchip() can skip the state machine until the next one that changes state or clamps
+    void MultiPCM::calc_env_segment(int slot_num)
+    {
+	auto &slot = slots[slot_num];
+	auto &env_delta = lanes.env_delta[slot_num];
+	auto &env_samples_left = lanes.env_samples_left[slot_num];
+
+	const uint32_t endless = 0xFFFFFFFF;
+	int32_t env_volume = lanes.env_volume[slot_num];
+
+	// Number of steps of the given size that keep the envelope
+	// below (or at or above) the given limit
+	auto steps_below = [&](int32_t rate, int32_t limit) -> uint32_t
+	{
+	    if (env_volume >= limit)
+	    {
+		return 0;
+	    }
+
+	    return (rate == 0) ? endless : ((limit - 1 - env_volume) / rate);
+	};
+
+	auto steps_above = [&](int32_t rate, int32_t limit) -> uint32_t
+	{
+	    if (env_volume < limit)
+	    {
+		return 0;
+	    }
+
+	    return (rate == 0) ? endless : ((env_volume - limit) / rate);
+	};
+
+	switch (slot.env_state)
+	{
+	    case multipcm_env_state::Attack:
+	    {
+		env_delta = slot.attack_rate;
+		env_samples_left = steps_below(slot.attack_rate, (0x3FF << 16));
+	    }
+	    break;
+	    case multipcm_env_state::Decay1:
+	    {
+		env_delta = -slot.decay_rate;
+		env_samples_left = steps_above(slot.decay_rate, ((slot.decay_level << 6) + 1) << 16);
+	    }
+	    break;
+	    case multipcm_env_state::Decay2:
+	    {
+		// Once the envelope reaches 0, it stays there
+		if (env_volume == 0)
+		{
+		    env_delta = 0;
+		    env_samples_left = endless;
+		}
+		else
+		{
+		    env_delta = -slot.decay2_rate;
+		    env_samples_left = steps_above(slot.decay2_rate, 1);
+		}
+	    }
+	    break;
+	    case multipcm_env_state::Release:
+	    {
+		env_delta = -slot.release_rate;
+		env_samples_left = steps_above(slot.release_rate, 1);
 	    }
 	    break;
 	    default:
 	    {
-		channel.final_volume = (1 << 12);
+		env_delta = 0;
+		env_samples_left = 0;
 	    }
 	    break;
 	}
     }
 
-    void MultiPCM::calc_env_rate(multipcm_channel &channel)
+    // Reloads both LFOs of a slot from its LFO registers
+    void MultiPCM::calc_lfo_steps(int slot_num)
+    {
+	auto &channel = channels[slot_num];
+	uint32_t phase_step = rate_tables->lfo_phase_steps[slots[slot_num].lfo_freq];
+
+	channel.pitch_lfo.phase_step = phase_step;
+	channel.pitch_lfo.scale = channel.pitch_lfo_depth;
+	update_pitch_lfo(slot_num);
+
+	channel.amp_lfo.phase_step = phase_step;
+	channel.amp_lfo.scale = channel.amp_lfo_depth;
+	update_amp_lfo(slot_num);
+    }
+
+    // Advances an LFO by one sample, and returns true if it moved on to a new table entry
+    inline BEEPCM_MULTIPCM_INLINE bool MultiPCM::lfo_tick(multipcm_lfo &lfo)
+    {
+	lfo.phase += lfo.phase_step;
+	uint8_t table_index = ((lfo.phase >> 8) & 0xFF);
+
+	if (table_index == lfo.table_index)
+	{
+	    return false;
+	}
+
+	lfo.table_index = table_index;
+	return true;
+    }
+
+    // Both LFOs also update the slot's lanes, which hold the step and amplitude
+    // the slot actually uses (so that the vector stages don't need to check the LFO depths)
+    void MultiPCM::update_pitch_lfo(int slot_num)
+    {
+	auto &channel = channels[slot_num];
+	auto &lfo = channel.pitch_lfo;
+	int32_t lfo_phase = tables->pitch_lfo_wave[lfo.table_index];
+	lfo.value = (tables->pitch_lfo_scales[lfo.scale][lfo_phase + 128] << 4);
+	channel.lfo_step = ((uint64_t(channel.step) * lfo.value) >> 12);
+	lanes.step[slot_num] = (channel.pitch_lfo_depth != 0) ? channel.lfo_step : channel.step;
+    }
+
+    void MultiPCM::update_amp_lfo(int slot_num)
     {
-	int32_t octave = channel.octave;
+	auto &channel = channels[slot_num];
+	auto &lfo = channel.amp_lfo;
+	int32_t lfo_phase = tables->amp_lfo_wave[lfo.table_index];
+	lfo.value = (tables->amp_lfo_scales[lfo.scale][lfo_phase] << 4);
+
+	// Multiplying by (1 << 12) leaves the sample as it is
+	lanes.amp_lfo_value[slot_num] = (channel.amp_lfo_depth != 0) ? lfo.value : (1 << 12);
+    }
+
+    void MultiPCM::calc_env_rate(multipcm_slot &slot)
+    {
+	int32_t octave = slot.octave;
 
 	if (testbit(octave, 3))
 	{
@@ -292,12 +694,12 @@ namespace beepcm
 
 	int32_t rate = 0;
 
-	if (channel.metadata.key_rate_scale != 0xF)
+	if (slot.metadata.key_rate_scale != 0xF)
 	{
-	    rate = (((octave + channel.metadata.key_rate_scale) * 2 + (testbit(channel.octave, 3))));
+	    rate = (((octave + slot.metadata.key_rate_scale) * 2 + (testbit(slot.octave, 3))));
 	}
 
-	auto get_rate = [&](array<uint32_t, 0x40> steps, uint32_t rate, uint32_t val) -> uint32_t
+	auto get_rate = [&](const array<uint32_t, 0x40> &steps, uint32_t rate, uint32_t val) -> uint32_t
 	{
 	    switch (val)
 	    {
@@ -306,18 +708,18 @@ namespace beepcm
 		default:
 		{
 		    int p_rate = (4 * val) + rate;
-		    int env_rate = min(0x3F, p_rate);
+		    int env_rate = max(0, min(0x3F, p_rate));
 		    return steps[env_rate];
 		}
 		break;
 	    }
 	};
 
-	channel.attack_rate = get_rate(attack_steps, rate, channel.metadata.attack_rate);
-	channel.decay_rate = get_rate(decay_steps, rate, channel.metadata.decay_rate);
-	channel.decay2_rate = get_rate(decay_steps, rate, channel.metadata.decay2_rate);
-	channel.release_rate = get_rate(decay_steps, rate, channel.metadata.release_rate);
-	channel.decay_level = (0xF - channel.metadata.decay_level);
+	slot.attack_rate = get_rate(rate_tables->attack_steps, rate, slot.metadata.attack_rate);
+	slot.decay_rate = get_rate(rate_tables->decay_steps, rate, slot.metadata.decay_rate);
+	slot.decay2_rate = get_rate(rate_tables->decay_steps, rate, slot.metadata.decay2_rate);
+	slot.release_rate = get_rate(rate_tables->decay_steps, rate, slot.metadata.release_rate);
+	slot.decay_level = (0xF - slot.metadata.decay_level);
     }
 
     void MultiPCM::writeSlot(int cur_slot, int address, uint8_t data)
@@ -328,94 +730,63 @@ namespace beepcm
 	}
 
 	auto &channel = channels[cur_slot];
+	auto &slot = slots[cur_slot];
 
 	switch (address)
 	{
 	    case 0:
 	    {
-		channel.panpot = (data >> 4);
+		lanes.pan_index[cur_slot] = ((data >> 4) << 7);
 	    }
 	    break;
 	    case 1:
 	    {
-		channel.sample_index = ((channel.sample_index & 0x100) | data);
-		init_sample(channel);
-
-		channel.format = channel.metadata.format;
-		channel.base_addr = channel.metadata.start_addr;
+		slot.sample_index = ((slot.sample_index & 0x100) | data);
+		init_sample(cur_slot);
 
-		if (channel.is_playing)
+		if (is_playing(cur_slot))
 		{
-		    retrigger_sample(channel);
+		    retrigger_sample(cur_slot);
 		}
 	    }
 	    break;
 	    case 2:
 	    {
-		channel.sample_index = ((channel.sample_index & 0xFF) | ((data & 0x1) << 8));
-		channel.pitch = ((channel.pitch & 0x3C0) | (data >> 2));
-		uint32_t pitch = freq_step_table.at(channel.pitch);
-
-		if (testbit(channel.octave, 3))
-		{
-		    pitch >>= (16 - channel.octave);
-		}
-		else
-		{
-		    pitch <<= channel.octave;
-		}
-
-		// Basic error checking for valid chip sample rates
-		if (chip_sample_rate == 0)
-		{
-		    throw runtime_error("Chip sample rate can not be 0 (did you forget to call get_sample_rate()?)");
-		}
+		slot.sample_index = ((slot.sample_index & 0xFF) | ((data & 0x1) << 8));
+		slot.pitch = ((slot.pitch & 0x3C0) | (data >> 2));
 
-		channel.step = (pitch / chip_sample_rate);
+		channel.step = rate_tables->pitch_steps[slot.octave][slot.pitch];
+		update_pitch_lfo(cur_slot);
 	    }
 	    break;
 	    case 3:
 	    {
-		channel.octave = (((data >> 4) - 1) & 0xF);
-		channel.pitch = ((channel.pitch & 0x3F) | ((data & 0xF) << 6));
-		uint32_t pitch = freq_step_table.at(channel.pitch);
-
-		if (testbit(channel.octave, 3))
-		{
-		    pitch >>= (16 - channel.octave);
-		}
-		else
-		{
-		    pitch <<= channel.octave;
-		}
-
-		// Basic error checking for valid chip sample rates
-		if (chip_sample_rate == 0)
-		{
-		    throw runtime_error("Chip sample rate can not be 0 (did you forget to call get_sample_rate()?)");
-		}
+		slot.octave = (((data >> 4) - 1) & 0xF);
+		slot.pitch = ((slot.pitch & 0x3F) | ((data & 0xF) << 6));
 
-		channel.step = (pitch / chip_sample_rate);
+		channel.step = rate_tables->pitch_steps[slot.octave][slot.pitch];
+		update_pitch_lfo(cur_slot);
 	    }
 	    break;
 	    case 4:
 	    {
 		if (testbit(data, 7))
 		{
-		    channel.is_playing = true;
-		    retrigger_sample(channel);
+		    set_playing(cur_slot, true);
+		    retrigger_sample(cur_slot);
 		}
 		else
 		{
-		    if (channel.is_playing)
+		    if (is_playing(cur_slot))
 		    {
-			if (channel.metadata.release_rate != 0xF)
+			if (slot.metadata.release_rate != 0xF)
 			{
-			    channel.env_state = multipcm_env_state::Release;
+			    slot.env_state = multipcm_env_state::Release;
+			    lanes.env_samples_left[cur_slot] = 0;
 			}
 			else
 			{
-			    channel.is_playing = false;
+			    set_playing(cur_slot, false);
 			}
 		    }
 		}
@@ -423,43 +794,83 @@ namespace beepcm
 	    break;
 	    case 5:
 	    {
-		channel.total_level = ((data >> 1) & 0x7F);
+		uint32_t total_level = ((data >> 1) & 0x7F);
+		lanes.total_level[cur_slot] = total_level;
 
 		if (!testbit(data, 0))
 		{
-		    if ((channel.tll_val >> 12) > channel.total_level)
+		    if ((lanes.tll_val[cur_slot] >> 12) > total_level)
 		    {
-			channel.tll_step = tll_steps[0]; // Decrease TLL
+			lanes.tll_step[cur_slot] = rate_tables->tll_steps[0]; // Decrease TLL
 		    }
 		    else
 		    {
-			channel.tll_step = tll_steps[1]; // Increase TLL
+			lanes.tll_step[cur_slot] = rate_tables->tll_steps[1]; // Increase TLL
 		    }
 		}
 		else
 		{
-		    channel.tll_val = (channel.total_level << 12);
+		    lanes.tll_val[cur_slot] = (total_level << 12);
 		}
 	    }
 	    break;
 	    case 6:
 	    {
-		cout << "Setting LFO frequency/pitch LFO of channel " << dec << cur_slot << endl;
+		slot.lfo_freq = ((data >> 3) & 0x7);
+		channel.pitch_lfo_depth = (data & 0x7);
+
+		// Only non-zero writes reload the LFOs
+		if (data != 0)
+		{
+		    calc_lfo_steps(cur_slot);
+		}
+		else
+		{
+		    update_pitch_lfo(cur_slot);
+		}
 	    }
 	    break;
 	    case 7:
 	    {
-		cout << "Setting amplitude LFO of channel " << dec << cur_slot << endl;
+		channel.amp_lfo_depth = (data & 0x7);
+
+		if (data != 0)
+		{
+		    calc_lfo_steps(cur_slot);
+		}
+		else
+		{
+		    update_amp_lfo(cur_slot);
+		}
 	    }
 	    break;
 	}
     }
 
     uint32_t MultiPCM::get_sample_rate(uint32_t clock_rate)
+    {
+	configure_clock(clock_rate);
+	return (output_rate != 0) ? output_rate : chip_sample_rate;
+    }
+
+    // Looks up the step tables for the chip's sample rate (and output rate),
+    // so that pitch, LFO and envelope register writes only need a table lookup
+    void MultiPCM::configure_clock(uint32_t clock_rate)
     {
 	chip_sample_rate = (clock_rate / 224.0);
-	init_tables();
-	return chip_sample_rate;
+	update_rate_tables();
+    }
+
+    void MultiPCM::update_rate_tables()
+    {
+	uint32_t step_rate = ((output_rate != 0) && (chip_sample_rate != 0)) ? output_rate : chip_sample_rate;
+	rate_tables = get_rate_tables(chip_sample_rate, step_rate);
+    }
+
+    void MultiPCM::set_output_rate(uint32_t clock_rate, uint32_t output_rate)
+    {
+	this->output_rate = output_rate;
+	configure_clock(clock_rate);
     }
 
     void MultiPCM::init()
@@ -473,11 +884,16 @@ namespace beepcm
 	left_bank = 0;
 	right_bank = 0;
 
-	for (auto &channel : channels)
+	for (auto &slot : slots)
+	{
+	    slot.env_state = multipcm_env_state::Attack;
+	}
+
+	for (int i = 0; i < 28; i++)
 	{
-	    channel.env_volume = 0;
-	    channel.env_state = multipcm_env_state::Attack;
-	    channel.is_playing = false;
+	    lanes.env_volume[i] = 0;
+	    lanes.env_samples_left[i] = 0;
+	    set_playing(i, false);
 	}
     }
 
@@ -537,8 +953,17 @@ namespace beepcm
 
     void MultiPCM::writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data)
     {
+	rom_hash.invalidate();
+	bool is_resized = (rom_size != multipcm_rom.size());
 	multipcm_rom.resize(rom_size, 0xFF);
 
+	// Resizing the ROM can change any of the headers, so decode them all again
+	if (is_resized)
+	{
+	    decode_sample_headers(0, (sample_headers.size() * 12));
+	    clear_sample_mirrors();
+	}
+
 	uint32_t data_length = data_len;
 	uint32_t data_end = (data_start + data_len);
 
@@ -553,106 +978,523 @@ namespace beepcm
 	}
 
 	copy(rom_data.begin(), (rom_data.begin() + data_length), (multipcm_rom.begin() + data_start));
+	decode_sample_headers(data_start, data_length);
+	clear_sample_mirrors();
+    }
+
+    void MultiPCM::set_playing(int slot_num, bool is_playing)
+    {
+	if (is_playing)
+	{
+	    playing_mask |= (1 << slot_num);
+	}
+	else
+	{
+	    playing_mask &= ~(1 << slot_num);
+	}
+
+	lanes.active_mask[slot_num] = is_playing ? 0xFFFFFFFF : 0;
+    }
+
+    inline BEEPCM_MULTIPCM_INLINE bool MultiPCM::is_playing(int slot_num)
+    {
+	return testbit(playing_mask, slot_num);
+    }
+
+    inline BEEPCM_MULTIPCM_INLINE int32_t MultiPCM::fetch_slot_sample(int slot_num)
+    {
+	auto &channel = channels[slot_num];
+	uint32_t spos = (lanes.offset[slot_num] >> 12);
+
+	if (is_mirror_enabled)
+	{
+	    if (channel.sample_mirror == nullptr)
+	    {
+		channel.sample_mirror = get_sample_mirror(channel);
+	    }
+
+	    return (*channel.sample_mirror)[spos];
+	}
+
+	return fetch_sample(channel.base_addr, channel.format, spos);
+    }
+
+    void MultiPCM::set_renderer(MultiPCMRenderer renderer)
+    {
+	// The sample fetches and the final mix (which every renderer does one slot at a time)
+	// take most of the time, so the vector renderers don't measurably beat the scalar one yet
+	// (see multipcm_bench), and Auto sticks with it
+	if (renderer == MultiPCMRenderer::Auto)
+	{
+	    renderer = MultiPCMRenderer::Scalar;
+	}
+
+#if !defined(BEEPCM_MULTIPCM_SSE2)
+	if (renderer == MultiPCMRenderer::SSE2)
+	{
+	    throw runtime_error("SSE2 is not supported by this build");
+	}
+#endif
+
+	if (renderer == MultiPCMRenderer::AVX2)
+	{
+#if defined(BEEPCM_MULTIPCM_AVX2)
+	    if (!__builtin_cpu_supports("avx2"))
+	    {
+		throw runtime_error("AVX2 is not supported by this CPU");
+	    }
+#else
+	    throw runtime_error("AVX2 is not supported by this build");
+#endif
+	}
+
+	this->renderer = renderer;
+    }
+
+    MultiPCMRenderer MultiPCM::get_renderer()
+    {
+	return renderer;
     }
 
     void MultiPCM::clockchip()
+    {
+	if (playing_mask == 0)
+	{
+	    return;
+	}
+
+	if (renderer == MultiPCMRenderer::Scalar)
+	{
+	    clock_scalar();
+	}
+	else
+	{
+	    clock_lanes();
+	}
+    }
+
+    // Clocks the playing slots one at a time (which is what the vector renderers have to match)
+    void MultiPCM::clock_scalar()
     {
 	for (int i = 0; i < 28; i++)
 	{
+	    if (!is_playing(i))
+	    {
+		continue;
+	    }
+
 	    auto &channel = channels[i];
-	    if (channel.is_playing)
+	    uint32_t volume = ((lanes.tll_val[i] >> 12) | lanes.pan_index[i]);
+	    uint32_t offset = lanes.offset[i];
+	    uint32_t spos = (offset >> 12);
+
+	    // Vibrato
+	    if ((channel.pitch_lfo_depth != 0) && lfo_tick(channel.pitch_lfo))
 	    {
-		uint32_t volume = ((channel.tll_val >> 12) | (channel.panpot << 7));
-		uint32_t spos = (channel.offset >> 12);
-		uint32_t step = channel.step;
-		int32_t csample = 0;
-		int32_t fpart = (channel.offset & 0xFFF);
+		update_pitch_lfo(i);
+	    }
 
-		if (testbit(channel.format, 3))
-		{
-		    uint32_t addr = (channel.base_addr + (spos >> 2) * 6);
+	    int32_t csample = fetch_slot_sample(i);
+	    int32_t fpart = (offset & 0xFFF);
 
-		    switch (spos & 3)
-		    {
-			case 0:
-			{
-			    // ab.c .... ....
-			    int16_t w0 = ((read_rom(addr) << 8) | ((read_rom(addr + 1) & 0xF) << 4));
-			    csample = w0;
-			}
-			break;
-			case 1:
-			{
-			    // ..C. AB.. ....
-			    int16_t w0 = ((read_rom(addr + 2) << 8) | (read_rom(addr + 1) & 0xF0));
-			    csample = w0;
-			}
-			break;
-			case 2:
-			{
-			    // .... ..ab .c..
-			    int16_t w0 = ((read_rom(addr + 3) << 8) | ((read_rom(addr + 4) & 0xF) << 4));
-			    csample = w0;
-			}
-			break;
-			case 3:
-			{
-			    // .... .... C.AB
-			    int16_t w0 = ((read_rom(addr + 5) << 8) | (read_rom(addr + 4) & 0xF0));
-			    csample = w0;
-			}
-			break;
-		    }
-		}
-		else
-		{
-		    csample = int16_t(read_rom(channel.base_addr + spos) << 8);
-		}
+	    int32_t sample = ((csample * fpart + lanes.prev_sample[i] * ((1 << 12) - fpart)) >> 12);
+	    offset += lanes.step[i];
+
+	    if (offset >= lanes.end_offset[i])
+	    {
+		offset = lanes.loop_offset[i];
+	    }
 
-		int32_t sample = ((csample * fpart + channel.prev_sample * ((1 << 12) - fpart)) >> 12);
-		channel.offset += step;
+	    lanes.offset[i] = offset;
 
-		if (channel.offset >= (channel.metadata.end_addr << 12))
-		{
-		    channel.offset = (channel.metadata.loop_addr << 12);
-		}
+	    // How often the sample position crosses into a new sample depends on the pitch,
+	    // so this is written as a select rather than a hard-to-predict branch
+	    lanes.prev_sample[i] = (spos != (offset >> 12)) ? csample : lanes.prev_sample[i];
 
-		if (spos ^ (channel.offset >> 12))
-		{
-		    channel.prev_sample = csample;
-		}
+	    if ((lanes.tll_val[i] >> 12) != lanes.total_level[i])
+	    {
+		lanes.tll_val[i] += lanes.tll_step[i];
+	    }
 
-		if ((channel.tll_val >> 12) != channel.total_level)
+	    // Tremolo
+	    if (channel.amp_lfo_depth != 0)
+	    {
+		if (lfo_tick(channel.amp_lfo))
 		{
-		    channel.tll_val += channel.tll_step;
+		    update_amp_lfo(i);
 		}
 
-		env_update(channel);
-		sample = ((sample * channel.final_volume) >> 10);
+		sample = ((sample * lanes.amp_lfo_value[i]) >> 12);
+	    }
+
+	    // The envelope state machine only needs to run at the end of each linear segment
+	    if (lanes.env_samples_left[i] != 0)
+	    {
+		lanes.env_samples_left[i] -= 1;
+		lanes.env_volume[i] += lanes.env_delta[i];
+		lanes.final_volume[i] = tables->volume_table[lanes.env_volume[i] >> 16];
+	    }
+	    else
+	    {
+		env_update(i);
+		calc_env_segment(i);
+	    }
+
+	    sample = ((sample * lanes.final_volume[i]) >> 10);
+
+	    lanes.output[0][i] = ((sample * tables->m_pan_table[0][volume]) >> 12);
+	    lanes.output[1][i] = ((sample * tables->m_pan_table[1][volume]) >> 12);
+	}
+    }
+
+    // Clocks all of the slots at once, with only the sample fetches, LFOs and
+    // envelope state changes (which depend on each slot's registers) being done one slot at a time
+    void MultiPCM::clock_lanes()
+    {
+	for (int i = 0; i < 28; i++)
+	{
+	    if (!is_playing(i))
+	    {
+		continue;
+	    }
+
+	    auto &channel = channels[i];
+
+	    if ((channel.pitch_lfo_depth != 0) && lfo_tick(channel.pitch_lfo))
+	    {
+		update_pitch_lfo(i);
+	    }
+
+	    if ((channel.amp_lfo_depth != 0) && lfo_tick(channel.amp_lfo))
+	    {
+		update_amp_lfo(i);
+	    }
+
+	    lanes.cur_sample[i] = fetch_slot_sample(i);
+	}
+
+	bool is_avx2 = (renderer == MultiPCMRenderer::AVX2);
+
+	if (is_avx2)
+	{
+	    interpolate_lanes_avx2(lanes, tables->volume_table.data());
+	}
+	else
+	{
+	    interpolate_lanes_sse2(lanes, tables->volume_table.data());
+	}
 
-		channel.output[0] = ((sample * m_pan_table[0][volume]) >> 12);
-		channel.output[1] = ((sample * m_pan_table[1][volume]) >> 12);
+	for (int i = 0; i < 28; i++)
+	{
+	    if (lanes.env_update_mask[i] != 0)
+	    {
+		env_update(i);
+		calc_env_segment(i);
 	    }
 	}
+
+	if (is_avx2)
+	{
+	    output_lanes_avx2(lanes, *tables);
+	}
+	else
+	{
+	    output_lanes_sse2(lanes, *tables);
+	}
+    }
+
+#if defined(BEEPCM_MULTIPCM_SSE2)
+    // The vector stages are written once against the operations below, which are
+    // provided for 4 slots at a time (SSE2) and 8 slots at a time (AVX2).
+    // Every result is selected by the lane's mask instead of branched on.
+    struct multipcm_sse2_ops
+    {
+	using vec = __m128i;
+	static constexpr int width = 4;
+
+	static BEEPCM_MULTIPCM_INLINE vec load(const void *ptr) { return _mm_load_si128(reinterpret_cast<const vec*>(ptr)); }
+	static BEEPCM_MULTIPCM_INLINE void store(void *ptr, vec val) { _mm_store_si128(reinterpret_cast<vec*>(ptr), val); }
+	static BEEPCM_MULTIPCM_INLINE vec set1(int32_t val) { return _mm_set1_epi32(val); }
+	static BEEPCM_MULTIPCM_INLINE vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec sub(vec a, vec b) { return _mm_sub_epi32(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec and_(vec a, vec b) { return _mm_and_si128(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec andnot(vec a, vec b) { return _mm_andnot_si128(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec or_(vec a, vec b) { return _mm_or_si128(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec xor_(vec a, vec b) { return _mm_xor_si128(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec cmpeq(vec a, vec b) { return _mm_cmpeq_epi32(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec cmpgt(vec a, vec b) { return _mm_cmpgt_epi32(a, b); }
+	static BEEPCM_MULTIPCM_INLINE vec select(vec mask, vec a, vec b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+	template<int shift>
+	static BEEPCM_MULTIPCM_INLINE vec srai(vec a) { return _mm_srai_epi32(a, shift); }
+
+	template<int shift>
+	static BEEPCM_MULTIPCM_INLINE vec srli(vec a) { return _mm_srli_epi32(a, shift); }
+
+	// SSE2 only has a 32x32->64-bit multiply, so the low halves of
+	// the even and odd lanes' products are shuffled back together
+	static BEEPCM_MULTIPCM_INLINE vec mullo(vec a, vec b)
+	{
+	    vec even = _mm_mul_epu32(a, b);
+	    vec odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+
+	// SSE2 has no gathers either, so the table is read one lane at a time
+	static BEEPCM_MULTIPCM_INLINE vec gather(const int32_t *table, vec index)
+	{
+	    alignas(16) array<int32_t, width> indices;
+	    store(indices.data(), index);
+	    return _mm_setr_epi32(table[indices[0]], table[indices[1]], table[indices[2]], table[indices[3]]);
+	}
+    };
+
+#if defined(BEEPCM_MULTIPCM_AVX2)
+// The AVX2 vectors never cross a call without AVX2 enabled (which is what -Wpsabi warns about),
+// as every use of them is flattened into the AVX2 entry points below
+#if !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// These can't be always_inline, as the stages that call them aren't built for AVX2
+// until they're flattened into the AVX2 entry points below
+#define BEEPCM_MULTIPCM_AVX2_INLINE inline __attribute__((target("avx2")))
+
+    struct multipcm_avx2_ops
+    {
+	using vec = __m256i;
+	static constexpr int width = 8;
+
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec load(const void *ptr) { return _mm256_load_si256(reinterpret_cast<const vec*>(ptr)); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE void store(void *ptr, vec val) { _mm256_store_si256(reinterpret_cast<vec*>(ptr), val); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec set1(int32_t val) { return _mm256_set1_epi32(val); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec sub(vec a, vec b) { return _mm256_sub_epi32(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec and_(vec a, vec b) { return _mm256_and_si256(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec andnot(vec a, vec b) { return _mm256_andnot_si256(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec or_(vec a, vec b) { return _mm256_or_si256(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec xor_(vec a, vec b) { return _mm256_xor_si256(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec cmpeq(vec a, vec b) { return _mm256_cmpeq_epi32(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec cmpgt(vec a, vec b) { return _mm256_cmpgt_epi32(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec select(vec mask, vec a, vec b) { return _mm256_blendv_epi8(b, a, mask); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec mullo(vec a, vec b) { return _mm256_mullo_epi32(a, b); }
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec gather(const int32_t *table, vec index) { return _mm256_i32gather_epi32(table, index, 4); }
+
+	template<int shift>
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec srai(vec a) { return _mm256_srai_epi32(a, shift); }
+
+	template<int shift>
+	static BEEPCM_MULTIPCM_AVX2_INLINE vec srli(vec a) { return _mm256_srli_epi32(a, shift); }
+    };
+#endif
+
+    template<typename Ops, typename Lanes>
+    static inline BEEPCM_MULTIPCM_INLINE void interpolate_lanes_impl(Lanes &lanes, const int32_t *volume_table)
+    {
+	using vec = typename Ops::vec;
+	constexpr int num_lanes = int(sizeof(lanes.offset) / sizeof(lanes.offset[0]));
+	static_assert((num_lanes % Ops::width) == 0, "Lane count must be a multiple of the vector width");
+
+	const vec zero = Ops::set1(0);
+	const vec frac_mask = Ops::set1(0xFFF);
+	const vec frac_one = Ops::set1(1 << 12);
+	// Flips unsigned values into signed order, since there are no unsigned compares
+	const vec sign_bit = Ops::set1(int32_t(0x80000000));
+
+	for (int i = 0; i < num_lanes; i += Ops::width)
+	{
+	    vec mask = Ops::load(&lanes.active_mask[i]);
+	    vec offset = Ops::load(&lanes.offset[i]);
+	    vec csample = Ops::load(&lanes.cur_sample[i]);
+	    vec old_prev_sample = Ops::load(&lanes.prev_sample[i]);
+	    vec fpart = Ops::and_(offset, frac_mask);
+
+	    vec sample = Ops::add(Ops::mullo(csample, fpart), Ops::mullo(old_prev_sample, Ops::sub(frac_one, fpart)));
+	    sample = Ops::template srai<12>(sample);
+
+	    vec new_offset = Ops::add(offset, Ops::load(&lanes.step[i]));
+	    vec end_offset = Ops::load(&lanes.end_offset[i]);
+	    vec is_before_end = Ops::cmpgt(Ops::xor_(end_offset, sign_bit), Ops::xor_(new_offset, sign_bit));
+	    new_offset = Ops::select(is_before_end, new_offset, Ops::load(&lanes.loop_offset[i]));
+
+	    vec same_pos = Ops::cmpeq(Ops::template srli<12>(offset), Ops::template srli<12>(new_offset));
+	    vec prev_sample = Ops::select(same_pos, old_prev_sample, csample);
+
+	    vec tll_val = Ops::load(&lanes.tll_val[i]);
+	    vec tll_level = Ops::template srli<12>(tll_val);
+	    vec volume_index = Ops::and_(Ops::or_(tll_level, Ops::load(&lanes.pan_index[i])), Ops::set1(0x7FF));
+	    vec tll_done = Ops::cmpeq(tll_level, Ops::load(&lanes.total_level[i]));
+	    vec new_tll_val = Ops::select(tll_done, tll_val, Ops::add(tll_val, Ops::load(&lanes.tll_step[i])));
+
+	    sample = Ops::template srai<12>(Ops::mullo(sample, Ops::load(&lanes.amp_lfo_value[i])));
+
+	    // Only lanes in the middle of an envelope segment are stepped here,
+	    // with the rest being left for the envelope state machine
+	    vec env_samples_left = Ops::load(&lanes.env_samples_left[i]);
+	    vec env_mask = Ops::andnot(Ops::cmpeq(env_samples_left, zero), mask);
+	    vec old_env_volume = Ops::load(&lanes.env_volume[i]);
+	    vec env_volume = Ops::add(old_env_volume, Ops::load(&lanes.env_delta[i]));
+	    vec env_index = Ops::and_(Ops::template srai<16>(env_volume), Ops::set1(0x3FF));
+	    vec final_volume = Ops::gather(volume_table, env_index);
+
+	    // Subtracting the all-ones mask counts the segment down by one
+	    Ops::store(&lanes.offset[i], Ops::select(mask, new_offset, offset));
+	    Ops::store(&lanes.prev_sample[i], Ops::select(mask, prev_sample, old_prev_sample));
+	    Ops::store(&lanes.tll_val[i], Ops::select(mask, new_tll_val, tll_val));
+	    Ops::store(&lanes.volume_index[i], volume_index);
+	    Ops::store(&lanes.sample[i], sample);
+	    Ops::store(&lanes.env_samples_left[i], Ops::add(env_samples_left, env_mask));
+	    Ops::store(&lanes.env_volume[i], Ops::select(env_mask, env_volume, old_env_volume));
+	    Ops::store(&lanes.final_volume[i], Ops::select(env_mask, final_volume, Ops::load(&lanes.final_volume[i])));
+	    Ops::store(&lanes.env_update_mask[i], Ops::andnot(env_mask, mask));
+	    Ops::store(&lanes.render_mask[i], mask);
+	}
+    }
+
+    template<typename Ops, typename Lanes, typename Tables>
+    static inline BEEPCM_MULTIPCM_INLINE void output_lanes_impl(Lanes &lanes, const Tables &tables)
+    {
+	using vec = typename Ops::vec;
+	constexpr int num_lanes = int(sizeof(lanes.offset) / sizeof(lanes.offset[0]));
+
+	for (int i = 0; i < num_lanes; i += Ops::width)
+	{
+	    vec mask = Ops::load(&lanes.render_mask[i]);
+	    vec volume = Ops::load(&lanes.volume_index[i]);
+	    vec sample = Ops::template srai<10>(Ops::mullo(Ops::load(&lanes.sample[i]), Ops::load(&lanes.final_volume[i])));
+	    vec left = Ops::template srai<12>(Ops::mullo(sample, Ops::gather(tables.m_pan_table[0].data(), volume)));
+	    vec right = Ops::template srai<12>(Ops::mullo(sample, Ops::gather(tables.m_pan_table[1].data(), volume)));
+
+	    Ops::store(&lanes.output[0][i], Ops::select(mask, left, Ops::load(&lanes.output[0][i])));
+	    Ops::store(&lanes.output[1][i], Ops::select(mask, right, Ops::load(&lanes.output[1][i])));
+	}
+    }
+
+    void MultiPCM::interpolate_lanes_sse2(multipcm_lanes &lanes, const int32_t *volume_table)
+    {
+	interpolate_lanes_impl<multipcm_sse2_ops>(lanes, volume_table);
+    }
+
+    void MultiPCM::output_lanes_sse2(multipcm_lanes &lanes, const multipcm_tables &tables)
+    {
+	output_lanes_impl<multipcm_sse2_ops>(lanes, tables);
+    }
+#else
+    // set_renderer() never selects the vector renderers in builds without SSE2
+    void MultiPCM::interpolate_lanes_sse2(multipcm_lanes&, const int32_t*)
+    {
+	return;
+    }
+
+    void MultiPCM::output_lanes_sse2(multipcm_lanes&, const multipcm_tables&)
+    {
+	return;
+    }
+#endif
+
+#if defined(BEEPCM_MULTIPCM_AVX2)
+    __attribute__((target("avx2"), flatten)) void MultiPCM::interpolate_lanes_avx2(multipcm_lanes &lanes, const int32_t *volume_table)
+    {
+	interpolate_lanes_impl<multipcm_avx2_ops>(lanes, volume_table);
+    }
+
+    __attribute__((target("avx2"), flatten)) void MultiPCM::output_lanes_avx2(multipcm_lanes &lanes, const multipcm_tables &tables)
+    {
+	output_lanes_impl<multipcm_avx2_ops>(lanes, tables);
+    }
+#else
+    // set_renderer() never selects AVX2 in builds without it
+    void MultiPCM::interpolate_lanes_avx2(multipcm_lanes&, const int32_t*)
+    {
+	return;
     }
 
+    void MultiPCM::output_lanes_avx2(multipcm_lanes&, const multipcm_tables&)
+    {
+	return;
+    }
+#endif
+
     vector<int32_t> MultiPCM::get_samples()
+    {
+	vector<int32_t> final_samples(2, 0);
+	get_samples(final_samples.data());
+	return final_samples;
+    }
+
+    void MultiPCM::get_samples(int32_t *samples)
     {
 	array<int32_t, 2> mixed_samples = {0, 0};
 
-	for (auto &channel : channels)
+	for (int ch = 0; ch < 28; ch++)
 	{
 	    for (int i = 0; i < 2; i++)
 	    {
 		int32_t old_sample = mixed_samples[i];
-		int32_t new_sample = clamp(channel.output[i], -32768, 32767);
+		int32_t new_sample = clamp(lanes.output[i][ch], -32768, 32767);
 		mixed_samples[i] = (old_sample + new_sample);
 	    }
 	}
 
-	vector<int32_t> final_samples;
-	final_samples.push_back(mixed_samples[0]);
-	final_samples.push_back(mixed_samples[1]);
-	return final_samples;
+	samples[0] = mixed_samples[0];
+	samples[1] = mixed_samples[1];
+    }
+
+    template<typename State>
+    void MultiPCM::sync_state(State &state)
+    {
+	state.sync(ch_num);
+	state.sync(cur_address);
+	state.sync(chip_bank);
+	state.sync(left_bank);
+	state.sync(right_bank);
+	state.sync(lanes);
+	state.sync(channels);
+	state.sync(slots);
+	state.sync(playing_mask);
+	state.sync(chip_sample_rate);
+	state.sync(output_rate);
+    }
+
+    vector<uint8_t> MultiPCM::save_state()
+    {
+	vector<uint8_t> state;
+	save_state(state);
+	return state;
+    }
+
+    void MultiPCM::save_state(vector<uint8_t> &state)
+    {
+	// Sample mirrors are looked up again when they're next needed,
+	// so that states don't contain pointers
+	for (auto &channel : channels)
+	{
+	    channel.sample_mirror = nullptr;
+	}
+
+	StateWriter writer("MPCM", state_version, rom_hash.get_hash(multipcm_rom), move(state));
+	sync_state(writer);
+	state = writer.get_state();
+    }
+
+    void MultiPCM::load_state(const vector<uint8_t> &state)
+    {
+	uint32_t prev_sample_rate = chip_sample_rate;
+	uint32_t prev_output_rate = output_rate;
+
+	StateReader reader(state, "MPCM", state_version, rom_hash.get_hash(multipcm_rom));
+	sync_state(reader);
+	reader.finish();
+
+	for (auto &channel : channels)
+	{
+	    channel.sample_mirror = nullptr;
+	}
+
+	// The rate tables only need looking up again if the state changed the rates
+	if ((rate_tables == nullptr) || (chip_sample_rate != prev_sample_rate) || (output_rate != prev_output_rate))
+	{
+	    update_rate_tables();
+	}
     }
 }
\ No newline at end of file
@@ -27,28 +27,77 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include "savestate.h"
+#include <map>
+#include <memory>
+#include <mutex>
 using namespace std;
 
 namespace beepcm
 {
+    // Renderers that MultiPCM::clockchip() can use, all of which give bit-exact results
+    // (the SSE2 and AVX2 renderers process four and eight slots per vector, and are only built for x86)
+    enum class MultiPCMRenderer : int
+    {
+	Auto = 0,
+	Scalar = 1,
+	SSE2 = 2,
+	AVX2 = 3,
+    };
+
     class MultiPCM
     {
 	public:
 	    MultiPCM();
 	    ~MultiPCM();
 
+	    // Each slot's sample mirror pointer points into this chip's mirrors, so copying a chip isn't allowed
+	    // (use save_state() and load_state() on another chip with the same ROM instead)
+	    MultiPCM(const MultiPCM&) = delete;
+	    MultiPCM &operator=(const MultiPCM&) = delete;
+
 	    uint32_t get_sample_rate(uint32_t clock_rate);
 	    void init();
+
+	    // Slots stay silent until either this or get_sample_rate() is called
 	    void configure_clock(uint32_t clock_rate);
+
+	    // Clocks the chip once per sample at output_rate instead of at its own sample rate (clock_rate / 224),
+	    // with the sample interpolation, LFOs and envelopes all stepping at the matching rate
+	    // (so no further resampling is needed), or goes back to the chip's own rate if output_rate is 0.
+	    // Like configure_clock(), this only affects slots that are written to afterwards,
+	    // and while it is set get_sample_rate() returns output_rate
+	    void set_output_rate(uint32_t clock_rate, uint32_t output_rate);
 	    void writeBankVGM(uint8_t offset, uint16_t data);
 	    void writeBank1M(int bank);
 	    void writeBank512K(int bank, bool is_lowbank);
 	    void writeIO(int port, uint8_t data);
 	    void writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data);
 
+	    // Unpacks each sample region into 16-bit words the first time it is played,
+	    // trading memory for a single load per sample (disabled by default)
+	    void enable_sample_mirror(bool is_enabled);
+
 	    void clockchip();
 	    vector<int32_t> get_samples();
 
+	    // Same as above, but writes the left and right samples to samples[0] and samples[1]
+	    void get_samples(int32_t *samples);
+
+	    // Selects the renderer used by clockchip() (Auto currently always picks Scalar),
+	    // throwing runtime_error if this build or the host CPU doesn't support it
+	    void set_renderer(MultiPCMRenderer renderer);
+	    MultiPCMRenderer get_renderer();
+
+	    // Saves the state of every slot, the banks and the clock and output rates
+	    // (with the ROM only being identified by its hash), and loads a state saved by a MultiPCM with the same ROM
+	    vector<uint8_t> save_state();
+	    void load_state(const vector<uint8_t> &state);
+
+	    // Same as save_state(), but reuses the storage of state,
+	    // so that a state can be saved every frame (e.g. for run-ahead) without allocating
+	    void save_state(vector<uint8_t> &state);
+
 	    void writeROM(vector<uint8_t> rom_data)
 	    {
 		writeROM(rom_data.size(), 0, rom_data.size(), rom_data);
@@ -62,17 +111,26 @@ namespace beepcm
 	    }
 
 	    void reset();
-	    void init_tables();
+
+	    static constexpr uint32_t state_version = 2;
+	    rom_hash_cache rom_hash;
+
+	    template<typename State>
+	    void sync_state(State &state);
 
 	    int ch_num = 0;
 	    int cur_address = 0;
 
-	    array<uint32_t, 0x400> freq_step_table;
-	    array<array<int32_t, 0x800>, 2> m_pan_table;
-	    array<int32_t, 2> tll_steps;
-	    array<uint32_t, 0x40> attack_steps;
-	    array<uint32_t, 0x40> decay_steps;
-	    array<int32_t, 0x400> volume_table;
+	    // Lookup tables are shared between all instances, with the
+	    // rate-dependent ones being cached for each sample rate
+	    struct multipcm_tables;
+	    struct multipcm_rate_tables;
+
+	    static const multipcm_tables &get_tables();
+	    static const multipcm_rate_tables *get_rate_tables(uint32_t sample_rate, uint32_t output_rate);
+
+	    const multipcm_tables *tables = nullptr;
+	    const multipcm_rate_tables *rate_tables = nullptr;
 
 	    int chip_bank = 0;
 	    int left_bank = 0;
@@ -89,58 +147,149 @@ namespace beepcm
 		Release = 3,
 	    };
 
+	    // Decoded form of one 12-byte sample header
 	    struct multipcm_data
 	    {
 		uint32_t start_addr = 0;
-		uint32_t format = 0;
 		uint16_t loop_addr = 0;
 		uint16_t end_addr = 0;
-		int attack_rate = 0;
-		int decay_rate = 0;
-		int decay2_rate = 0;
-		int decay_level = 0;
-		int release_rate = 0;
-		int key_rate_scale = 0;
+		uint8_t format = 0;
+		uint8_t attack_rate = 0;
+		uint8_t decay_rate = 0;
+		uint8_t decay2_rate = 0;
+		uint8_t decay_level = 0;
+		uint8_t release_rate = 0;
+		uint8_t key_rate_scale = 0;
+	    };
+
+	    // State of one of a slot's LFOs, whose output is only
+	    // recalculated when it moves on to a new waveform table entry
+	    struct multipcm_lfo
+	    {
+		uint32_t phase = 0;
+		uint32_t phase_step = 0;
+		int32_t value = (1 << 12);
+		int scale = 0;
+		uint8_t table_index = 0;
+	    };
+
+	    // Per-sample state of every slot, laid out as a structure of arrays
+	    // so that clockchip() can process eight slots per vector
+	    // (the last four lanes are padding, and never play).
+	    // Each array fills exactly two cache lines, and the whole block is cache line aligned,
+	    // so none of its lines are shared with the colder per-slot state below
+	    static constexpr int num_lanes = 32;
+
+	    struct alignas(64) multipcm_lanes
+	    {
+		array<uint32_t, num_lanes> active_mask = {};
+		array<uint32_t, num_lanes> offset = {};
+		array<uint32_t, num_lanes> step = {};
+		array<uint32_t, num_lanes> loop_offset = {};
+		array<uint32_t, num_lanes> end_offset = {};
+		array<int32_t, num_lanes> prev_sample = {};
+		array<uint32_t, num_lanes> tll_val = {};
+		array<int32_t, num_lanes> tll_step = {};
+		array<uint32_t, num_lanes> total_level = {};
+		array<uint32_t, num_lanes> pan_index = {};
+		array<int32_t, num_lanes> amp_lfo_value = {};
+		array<int32_t, num_lanes> env_volume = {};
+		array<int32_t, num_lanes> env_delta = {};
+		array<uint32_t, num_lanes> env_samples_left = {};
+		array<int32_t, num_lanes> final_volume = {};
+		array<array<int32_t, num_lanes>, 2> output = {};
+
+		// Scratch values passed between the stages of a clock
+		array<int32_t, num_lanes> cur_sample = {};
+		array<int32_t, num_lanes> sample = {};
+		array<uint32_t, num_lanes> volume_index = {};
+		array<uint32_t, num_lanes> render_mask = {};
+		array<uint32_t, num_lanes> env_update_mask = {};
 	    };
 
+	    static_assert((sizeof(multipcm_lanes) % 64) == 0, "Slot lanes must fill whole cache lines");
+
+	    // State of a slot that is only needed to fetch its samples and run its LFOs
 	    struct multipcm_channel
 	    {
-		uint32_t pitch = 0;
-		uint8_t octave = 0;
 		uint32_t step = 0;
-		int32_t prev_sample = 0;
-		uint32_t total_level = 0;
-		int32_t tll_step = 0;
-		uint32_t tll_val = 0;
+		uint32_t lfo_step = 0;
 		uint32_t base_addr = 0;
+		uint16_t loop_addr = 0;
+		uint16_t end_addr = 0;
+		uint8_t format = 0;
+		uint8_t pitch_lfo_depth = 0;
+		uint8_t amp_lfo_depth = 0;
+		const vector<int16_t> *sample_mirror = nullptr;
+		multipcm_lfo pitch_lfo;
+		multipcm_lfo amp_lfo;
+	    };
+
+	    // Register and envelope configuration of a slot,
+	    // which is only needed on register writes and envelope state changes
+	    struct multipcm_slot
+	    {
+		uint32_t pitch = 0;
+		uint8_t octave = 0;
 		uint16_t sample_index = 0;
-		uint32_t offset = 0;
-		uint32_t format = 0;
-		int panpot = 0;
 		int attack_rate = 0;
 		int decay_rate = 0;
 		int decay2_rate = 0;
 		int decay_level = 0;
 		int release_rate = 0;
-		bool is_playing = false;
-		array<int32_t, 2> output = {0, 0};
-		multipcm_env_state env_state;
-		int32_t env_volume = 0;
-		int32_t final_volume = 0;
+		multipcm_env_state env_state = multipcm_env_state::Attack;
+		int lfo_freq = 0;
 		multipcm_data metadata;
 	    };
 
+	    multipcm_lanes lanes;
 	    array<multipcm_channel, 28> channels;
+	    array<multipcm_slot, 28> slots;
+
+	    // Bitmask of the slots that are playing
+	    uint32_t playing_mask = 0;
+	    void set_playing(int slot_num, bool is_playing);
+	    bool is_playing(int slot_num);
 
-	    void init_sample(multipcm_channel &channel);
-	    void retrigger_sample(multipcm_channel &channel);
-	    void calc_env_rate(multipcm_channel &channel);
-	    void env_update(multipcm_channel &channel);
+	    MultiPCMRenderer renderer = MultiPCMRenderer::Scalar;
+	    void clock_scalar();
+	    void clock_lanes();
+
+	    // Vector stages of clock_lanes(), built for each instruction set
+	    static void interpolate_lanes_sse2(multipcm_lanes &lanes, const int32_t *volume_table);
+	    static void output_lanes_sse2(multipcm_lanes &lanes, const multipcm_tables &tables);
+	    static void interpolate_lanes_avx2(multipcm_lanes &lanes, const int32_t *volume_table);
+	    static void output_lanes_avx2(multipcm_lanes &lanes, const multipcm_tables &tables);
+
+	    // All 512 sample headers, decoded whenever the ROM is written
+	    array<multipcm_data, 0x200> sample_headers;
+
+	    void decode_sample_headers(uint32_t start, uint32_t length);
+	    void init_sample(int slot_num);
+	    void retrigger_sample(int slot_num);
+	    void calc_env_rate(multipcm_slot &slot);
+	    void env_update(int slot_num);
+	    void calc_env_segment(int slot_num);
+	    void calc_lfo_steps(int slot_num);
+	    bool lfo_tick(multipcm_lfo &lfo);
+	    void update_pitch_lfo(int slot_num);
+	    void update_amp_lfo(int slot_num);
+	    int32_t fetch_slot_sample(int slot_num);
 	    uint8_t read_rom(uint32_t addr);
+	    int16_t fetch_sample(uint32_t base_addr, uint32_t format, uint32_t spos);
+	    const vector<int16_t> *get_sample_mirror(multipcm_channel &channel);
+	    void clear_sample_mirrors();
 
 	    vector<uint8_t> multipcm_rom;
 
+	    // Unpacked sample regions, keyed by start address with the format in bit 31
+	    bool is_mirror_enabled = false;
+	    map<uint32_t, vector<int16_t>> sample_mirrors;
+
 	    uint32_t chip_sample_rate = 0;
+	    uint32_t output_rate = 0;
+
+	    void update_rate_tables();
     };
 };
 
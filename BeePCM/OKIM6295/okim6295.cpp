@@ -252,6 +252,8 @@ namespace beepcm
 
     void OkiM6295::writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data)
     {
+	rom_hash.invalidate();
+
 	m6295_rom.resize(rom_size, 0xFF);
 
 	uint32_t data_length = data_len;
@@ -282,6 +284,13 @@ namespace beepcm
     }
 
     vector<int32_t> OkiM6295::get_samples()
+    {
+	vector<int32_t> final_samples(1, 0);
+	get_samples(final_samples.data());
+	return final_samples;
+    }
+
+    void OkiM6295::get_samples(int32_t *samples)
     {
 	int32_t sample = 0;
 
@@ -290,8 +299,35 @@ namespace beepcm
 	    sample += voice.output;
 	}
 
-	vector<int32_t> samples;
-	samples.push_back(sample);
-	return samples;
+	samples[0] = sample;
+    }
+
+    template<typename State>
+    void OkiM6295::sync_state(State &state)
+    {
+	state.sync(is_pin7_set);
+	state.sync(m6295_cmd);
+	state.sync(voices);
+    }
+
+    vector<uint8_t> OkiM6295::save_state()
+    {
+	vector<uint8_t> state;
+	save_state(state);
+	return state;
+    }
+
+    void OkiM6295::save_state(vector<uint8_t> &state)
+    {
+	StateWriter writer("6295", state_version, rom_hash.get_hash(m6295_rom), move(state));
+	sync_state(writer);
+	state = writer.get_state();
+    }
+
+    void OkiM6295::load_state(const vector<uint8_t> &state)
+    {
+	StateReader reader(state, "6295", state_version, rom_hash.get_hash(m6295_rom));
+	sync_state(reader);
+	reader.finish();
     }
 }
\ No newline at end of file
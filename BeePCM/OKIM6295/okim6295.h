@@ -28,6 +28,7 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include "savestate.h"
 using namespace std;
 
 namespace beepcm
@@ -47,6 +48,18 @@ namespace beepcm
 	    void clockchip();
 	    vector<int32_t> get_samples();
 
+	    // Same as above, but writes the sample to samples[0]
+	    void get_samples(int32_t *samples);
+
+	    // Saves the state of all four voices (with the ROM only being identified by its hash),
+	    // and loads a state saved by an OKIM6295 with the same ROM
+	    vector<uint8_t> save_state();
+	    void load_state(const vector<uint8_t> &state);
+
+	    // Same as save_state(), but reuses the storage of state,
+	    // so that a state can be saved every frame (e.g. for run-ahead) without allocating
+	    void save_state(vector<uint8_t> &state);
+
 	    void writeROM(vector<uint8_t> rom_data)
 	    {
 		writeROM(rom_data.size(), 0, rom_data.size(), rom_data);
@@ -61,6 +74,12 @@ namespace beepcm
 
 	    void reset();
 
+	    static constexpr uint32_t state_version = 1;
+	    rom_hash_cache rom_hash;
+
+	    template<typename State>
+	    void sync_state(State &state);
+
 	    bool is_pin7_set = false;
 
 	    int m6295_cmd = -1;
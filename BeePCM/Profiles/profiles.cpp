@@ -0,0 +1,66 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-Profiles
+//
+// Most of the boards that these cores are used for carry one of a handful of combinations of sound chips,
+// so rather than wiring each chip up to its own buffer and mixing them afterwards,
+// each common combination gets a profile that ProfileBoard can render in a single loop.
+//
+// The clock rates and settings below match those used by MAME for each board.
+
+#include "profiles.h"
+using namespace beepcm;
+
+namespace beepcm
+{
+    void CPS1Profile::configure(chip_set &chips)
+    {
+	get<0>(chips).setPin7(true);
+    }
+
+    void System16Profile::configure(chip_set &chips)
+    {
+	// Same as MAME's segapcm_device::BANK_512
+	get<0>(chips).set_bank(12);
+    }
+
+    void MegaCDProfile::configure(chip_set &chips)
+    {
+	(void)chips;
+    }
+
+    void Model1Profile::configure(chip_set &chips)
+    {
+	for (auto *chip : {&get<0>(chips), &get<1>(chips)})
+	{
+	    chip->writeBank512K(0, true);
+	    chip->writeBank512K(0, false);
+	}
+    }
+
+    void Model1Profile::write_bank(chip_set &chips, int chip, int bank, bool is_lowbank)
+    {
+	switch (chip)
+	{
+	    case 0: get<0>(chips).writeBank512K(bank, is_lowbank); break;
+	    case 1: get<1>(chips).writeBank512K(bank, is_lowbank); break;
+	    default: throw out_of_range("Invalid Model 1 MultiPCM"); break;
+	}
+    }
+};
\ No newline at end of file
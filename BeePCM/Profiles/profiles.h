@@ -0,0 +1,237 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEEPCM_PROFILES
+#define BEEPCM_PROFILES
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <array>
+#include <tuple>
+#include <utility>
+#include "segapcm.h"
+#include "rf5c68.h"
+#include "multipcm.h"
+#include "upd7759.h"
+#include "okim6295.h"
+using namespace std;
+
+namespace beepcm
+{
+    // Each profile lists the sound chips on a board (in chip_set), their clock rates,
+    // and sets up anything else about them that the board fixes (i.e. pin states and banking)
+
+    // Capcom CPS1: an OKIM6295 at 1 MHz, with pin 7 high
+    struct CPS1Profile
+    {
+	using chip_set = tuple<OkiM6295>;
+	static constexpr array<uint32_t, 1> clock_rates = {1000000};
+	static void configure(chip_set &chips);
+    };
+
+    // Sega System 16: a SegaPCM at 4 MHz (with 512 KB sample banks) and a uPD7759 at 640 kHz
+    struct System16Profile
+    {
+	using chip_set = tuple<SegaPCM, uPD7759>;
+	static constexpr array<uint32_t, 2> clock_rates = {4000000, 640000};
+	static void configure(chip_set &chips);
+    };
+
+    // Sega Mega CD: an RF5C164 at 12.5 MHz
+    struct MegaCDProfile
+    {
+	using chip_set = tuple<RF5C164>;
+	static constexpr array<uint32_t, 1> clock_rates = {12500000};
+	static void configure(chip_set &chips);
+    };
+
+    // Sega Model 1: two MultiPCMs at 8 MHz, each with two 512 KB sample banks
+    struct Model1Profile
+    {
+	using chip_set = tuple<MultiPCM, MultiPCM>;
+	static constexpr array<uint32_t, 2> clock_rates = {8000000, 8000000};
+	static void configure(chip_set &chips);
+
+	// Handles a write to one of the sound CPU's bank registers
+	static void write_bank(chip_set &chips, int chip, int bank, bool is_lowbank);
+    };
+
+    // Renders all of the chips of a board in a single loop, summing their outputs
+    // straight into one accumulator (with no per-chip buffers or calls through function pointers).
+    // Chips running at a different rate than the board are clocked as many times as needed for each output sample,
+    // with their output being averaged (when faster) or held (when slower)
+    template<typename Profile>
+    class ProfileBoard
+    {
+	public:
+	    // An output rate of 0 renders at the first chip's own sample rate
+	    ProfileBoard(uint32_t output_rate = 0)
+	    {
+		apply_to_chips([](auto &chip, size_t) { chip.init(); });
+		Profile::configure(chips);
+
+		apply_to_chips([&](auto &chip, size_t index)
+		{
+		    chip_rates[index] = chip.get_sample_rate(Profile::clock_rates[index]);
+		});
+
+		sample_rate = (output_rate != 0) ? output_rate : chip_rates[0];
+
+		for (size_t i = 0; i < num_chips; i++)
+		{
+		    clock_steps[i] = ((uint64_t(chip_rates[i]) << 32) / sample_rate);
+		    clock_phases[i] = 0;
+		    chip_outputs[i] = {0, 0};
+		}
+	    }
+
+	    ~ProfileBoard()
+	    {
+
+	    }
+
+	    uint32_t get_sample_rate()
+	    {
+		return sample_rate;
+	    }
+
+	    typename Profile::chip_set &get_chips()
+	    {
+		return chips;
+	    }
+
+	    template<size_t index>
+	    auto &get_chip()
+	    {
+		return get<index>(chips);
+	    }
+
+	    // Renders num_frames frames into output (as interleaved left/right pairs)
+	    void render(int16_t *output, int num_frames)
+	    {
+		for (int frame = 0; frame < num_frames; frame++)
+		{
+		    array<int32_t, 2> mixed_samples = {0, 0};
+		    render_chips(mixed_samples, make_index_sequence<num_chips>());
+		    output[(frame * 2)] = clamp(mixed_samples[0], -32768, 32767);
+		    output[(frame * 2) + 1] = clamp(mixed_samples[1], -32768, 32767);
+		}
+	    }
+
+	private:
+	    static constexpr size_t num_chips = tuple_size<typename Profile::chip_set>::value;
+
+	    typename Profile::chip_set chips;
+	    uint32_t sample_rate = 0;
+
+	    array<uint32_t, num_chips> chip_rates;
+
+	    // Number of clocks of each chip per output sample, in 32.32 fixed point
+	    array<uint64_t, num_chips> clock_steps;
+	    array<uint64_t, num_chips> clock_phases;
+
+	    // Latest (or averaged) output of each chip, with mono chips sent to both channels
+	    array<array<int32_t, 2>, num_chips> chip_outputs;
+
+	    template<typename Func>
+	    void apply_to_chips(Func func)
+	    {
+		apply_to_chips(func, make_index_sequence<num_chips>());
+	    }
+
+	    template<typename Func, size_t... indices>
+	    void apply_to_chips(Func func, index_sequence<indices...>)
+	    {
+		(func(get<indices>(chips), indices), ...);
+	    }
+
+	    template<size_t... indices>
+	    void render_chips(array<int32_t, 2> &mixed_samples, index_sequence<indices...>)
+	    {
+		(render_chip<indices>(mixed_samples), ...);
+	    }
+
+	    // The uPD7759 is the only core that names this differently
+	    static void clock_chip(uPD7759 &chip)
+	    {
+		chip.clock_chip();
+	    }
+
+	    template<typename T>
+	    static void clock_chip(T &chip)
+	    {
+		chip.clockchip();
+	    }
+
+	    template<typename T>
+	    static constexpr bool is_mono()
+	    {
+		return (is_same<T, OkiM6295>::value || is_same<T, uPD7759>::value);
+	    }
+
+	    template<size_t index>
+	    void render_chip(array<int32_t, 2> &mixed_samples)
+	    {
+		auto &chip = get<index>(chips);
+		constexpr bool is_mono_chip = is_mono<typename tuple_element<index, typename Profile::chip_set>::type>();
+
+		uint64_t phase = (clock_phases[index] + clock_steps[index]);
+		uint32_t num_clocks = uint32_t(phase >> 32);
+		clock_phases[index] = (phase & 0xFFFFFFFF);
+
+		if (num_clocks != 0)
+		{
+		    array<int32_t, 2> sum = {0, 0};
+
+		    for (uint32_t i = 0; i < num_clocks; i++)
+		    {
+			array<int32_t, 2> samples = {0, 0};
+			clock_chip(chip);
+			chip.get_samples(samples.data());
+
+			if constexpr (is_mono_chip)
+			{
+			    samples[1] = samples[0];
+			}
+
+			sum[0] += samples[0];
+			sum[1] += samples[1];
+		    }
+
+		    if (num_clocks != 1)
+		    {
+			sum[0] /= int32_t(num_clocks);
+			sum[1] /= int32_t(num_clocks);
+		    }
+
+		    chip_outputs[index] = sum;
+		}
+
+		mixed_samples[0] += chip_outputs[index][0];
+		mixed_samples[1] += chip_outputs[index][1];
+	    }
+    };
+
+    using CPS1Board = ProfileBoard<CPS1Profile>;
+    using System16Board = ProfileBoard<System16Profile>;
+    using MegaCDBoard = ProfileBoard<MegaCDProfile>;
+    using Model1Board = ProfileBoard<Model1Profile>;
+};
+
+#endif // BEEPCM_PROFILES
\ No newline at end of file
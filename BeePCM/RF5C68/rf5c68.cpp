@@ -36,22 +36,28 @@ using namespace beepcm;
 
 namespace beepcm
 {
-    RF5C68::RF5C68()
+    template<RF5CType chip_type>
+    RF5CChip<chip_type>::RF5CChip()
     {
-
+	rf5c68_ram.fill(0);
+	signed_ram.fill(0);
+	loop_markers.fill(0);
     }
 
-    RF5C68::~RF5C68()
+    template<RF5CType chip_type>
+    RF5CChip<chip_type>::~RF5CChip()
     {
 
     }
 
-    uint32_t RF5C68::get_sample_rate(uint32_t clock_rate)
+    template<RF5CType chip_type>
+    uint32_t RF5CChip<chip_type>::get_sample_rate(uint32_t clock_rate)
     {
 	return (clock_rate / 384.0);
     }
 
-    void RF5C68::check_vgm_samples(uint32_t addr, uint16_t speed)
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::check_vgm_samples(uint32_t addr, uint16_t speed)
     {
 	if (!is_vgm_hack)
 	{
@@ -85,16 +91,15 @@ namespace beepcm
 		}
 		else
 		{
-		    auto begin = (vgm_data.begin() + (vgm_cur_addr - vgm_base_addr));
-		    auto end = (begin + (sample_speed * 4));
-		    copy(begin, end, (rf5c68_ram.begin() + vgm_cur_addr));
+		    update_ram(vgm_cur_addr, &vgm_data[vgm_cur_addr - vgm_base_addr], (sample_speed * 4));
 		    vgm_cur_addr += (sample_speed * 4);
 		}
 	    }
 	}
     }
 
-    void RF5C68::flush_vgm()
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::flush_vgm()
     {
 	if (!is_vgm_hack)
 	{
@@ -106,32 +111,116 @@ namespace beepcm
 	    return;
 	}
 
-	auto begin = (vgm_data.begin() + (vgm_cur_addr - vgm_base_addr));
-	auto end = (begin + (vgm_end_addr - vgm_cur_addr));
+	update_ram(vgm_cur_addr, &vgm_data[vgm_cur_addr - vgm_base_addr], (vgm_end_addr - vgm_cur_addr));
+	vgm_cur_addr = vgm_end_addr;
+    }
 
-	copy(begin, end, (rf5c68_ram.begin() + vgm_cur_addr));
+    // Streams the next num_samples bytes of the current block into RAM
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::advance_vgm(uint32_t num_samples)
+    {
+	if (vgm_cur_addr >= vgm_end_addr)
+	{
+	    return;
+	}
 
-	vgm_cur_addr = vgm_end_addr;
+	uint32_t byte_count = min<uint32_t>(num_samples, (vgm_end_addr - vgm_cur_addr));
+	update_ram(vgm_cur_addr, &vgm_data[vgm_cur_addr - vgm_base_addr], byte_count);
+	vgm_cur_addr += byte_count;
     }
 
-    void RF5C68::init()
+    // Returns how many samples can be rendered before any channel gets close enough
+    // to the stream for check_vgm_samples() to move it,
+    // and without any channel reading a byte the stream writes in the meantime
+    template<RF5CType chip_type>
+    uint32_t RF5CChip<chip_type>::vgm_safe_samples()
+    {
+	uint32_t num_samples = 0xFFFFFFFF;
+
+	// Channels next to the stream are the common case,
+	// so check all of them before doing any marker lookups
+	for (auto &channel : rf5c68_channels)
+	{
+	    if (!channel.is_enable)
+	    {
+		continue;
+	    }
+
+	    uint32_t ram_addr = ((channel.current_addr >> 11) & 0xFFFF);
+	    uint32_t sample_speed = (channel.step >= 0x800) ? (channel.step >> 11) : 1;
+	    uint32_t distance = (ram_addr >= vgm_cur_addr) ? (ram_addr - vgm_cur_addr) : (vgm_cur_addr - ram_addr);
+
+	    if (distance <= (sample_speed * 5))
+	    {
+		return 0;
+	    }
+
+	    // The stream moves by at most 1 byte per sample, and the channel by at most (step >> 11) + 1 bytes,
+	    // so the gap can't close by more than the latter per sample
+	    // (which also keeps a channel behind the stream from reaching any byte it writes)
+	    uint32_t max_move = ((channel.step >> 11) + 1);
+	    num_samples = min(num_samples, (((distance - (sample_speed * 5) - 1) / max_move) + 1));
+	}
+
+	// Loop jumps and wrapping around the end of RAM move a channel
+	// in ways the above doesn't account for
+	for (auto &channel : rf5c68_channels)
+	{
+	    if (!channel.is_enable)
+	    {
+		continue;
+	    }
+
+	    uint32_t max_distance = uint32_t(min<uint64_t>(((uint64_t(num_samples) * channel.step) >> 11) + 1, 0x10000));
+	    num_samples = min(num_samples, samples_until_marker(channel, max_distance));
+	    num_samples = min(num_samples, samples_until_addr(channel, 0x10000));
+	}
+
+	return num_samples;
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::init()
     {
 	reset();
     }
 
-    void RF5C68::enable_vgm_hack(bool is_enabled)
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::enable_vgm_hack(bool is_enabled)
     {
 	is_vgm_hack = is_enabled;
     }
 
-    void RF5C68::reset()
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::reset()
     {
 	rf5c68_ram.fill(0);
+	signed_ram.fill(0);
+	loop_markers.fill(0);
 	mem_bank = 0;
 	ch_bank = 0;
     }
 
-    void RF5C68::writeRAM(int data_start, int data_len, vector<uint8_t> ram_data)
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::writeRAM(int data_start, int data_len, vector<uint8_t> ram_data)
+    {
+	uint32_t data_offs = (data_start | (mem_bank << 12));
+
+	if (!is_vgm_hack || (data_offs >= rf5c68_ram.size()))
+	{
+	    writeRAM(data_start, data_len, ram_data.data());
+	    return;
+	}
+
+	// The stream takes over the block instead of copying it
+	// (after finishing off the previous one, which may be using the old buffer)
+	flush_vgm();
+	vgm_buffer = move(ram_data);
+	writeRAM(data_start, data_len, vgm_buffer.data());
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::writeRAM(int data_start, int data_len, const uint8_t *ram_data)
     {
 	uint32_t data_offs = (data_start | (mem_bank << 12));
 	uint32_t data_length = data_len;
@@ -154,7 +243,6 @@ namespace beepcm
 	    vgm_base_addr = data_offs;
 	    vgm_cur_addr = vgm_base_addr;
 	    vgm_end_addr = (vgm_base_addr + data_length);
-	    vgm_cur_step = 0;
 	    vgm_data = ram_data;
 
 	    uint32_t byte_count = 0x40; // Certain VGMs need such a high value
@@ -164,24 +252,89 @@ namespace beepcm
 		byte_count = (vgm_end_addr - vgm_cur_addr);
 	    }
 
-	    auto begin = (vgm_data.begin() + (vgm_cur_addr - vgm_base_addr));
-	    auto end = (begin + byte_count);
-	    copy(begin, end, (rf5c68_ram.begin() + vgm_cur_addr));
+	    update_ram(vgm_cur_addr, &vgm_data[vgm_cur_addr - vgm_base_addr], byte_count);
 	    vgm_cur_addr += byte_count;
 	}
 	else
 	{
-	    copy(ram_data.begin(), (ram_data.begin() + data_length), (rf5c68_ram.begin() + data_offs));
+	    update_ram(data_offs, ram_data, data_length);
 	}
     }
 
-    void RF5C68::writemem(uint16_t addr, uint8_t data)
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::writemem(uint16_t addr, uint8_t data)
     {
 	uint32_t ram_addr = ((mem_bank << 12) | (addr & 0xFFF));
-	rf5c68_ram.at(ram_addr) = data;
+	write_ram_byte(ram_addr, data);
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::writemem(uint16_t addr, const uint8_t *data, size_t length)
+    {
+	uint32_t bank_addr = (mem_bank << 12);
+	uint32_t offset = (addr & 0xFFF);
+
+	// Split the transfer wherever it wraps around the end of the bank
+	while (length > 0)
+	{
+	    uint32_t chunk_length = uint32_t(min<size_t>(length, (0x1000 - offset)));
+	    update_ram((bank_addr | offset), data, chunk_length);
+	    data += chunk_length;
+	    length -= chunk_length;
+	    offset = 0;
+	}
+    }
+
+    // Copies data into wave RAM, keeping the signed copy and loop marker index in sync
+    // (the range must not go past the end of RAM)
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::update_ram(uint32_t addr, const uint8_t *data, uint32_t length)
+    {
+	copy(data, (data + length), (rf5c68_ram.begin() + addr));
+
+	for (uint32_t i = addr; i < (addr + length); i++)
+	{
+	    int8_t magnitude = (rf5c68_ram[i] & 0x7F);
+	    signed_ram[i] = testbit(rf5c68_ram[i], 7) ? magnitude : -magnitude;
+	}
+
+	// Rebuild the marker bits one 64-bit word at a time
+	uint32_t end_addr = (addr + length);
+
+	while (addr < end_addr)
+	{
+	    uint32_t word_end = min<uint32_t>(end_addr, ((addr | 63) + 1));
+	    uint64_t &markers = loop_markers[(addr >> 6)];
+	    uint64_t range_bits = 0;
+	    uint64_t marker_bits = 0;
+
+	    for (; addr < word_end; addr++)
+	    {
+		uint64_t addr_bit = (uint64_t(1) << (addr & 63));
+		range_bits |= addr_bit;
+		marker_bits |= (rf5c68_ram[addr] == 0xFF) ? addr_bit : 0;
+	    }
+
+	    markers = ((markers & ~range_bits) | marker_bits);
+	}
     }
 
-    void RF5C68::writereg(uint8_t reg, uint8_t data)
+    template<RF5CType chip_type>
+    inline void RF5CChip<chip_type>::write_ram_byte(uint32_t addr, uint8_t data)
+    {
+	rf5c68_ram.at(addr) = data;
+
+	// Samples are stored in sign-magnitude form, with bit 7 set for positive samples
+	int8_t magnitude = (data & 0x7F);
+	signed_ram[addr] = testbit(data, 7) ? magnitude : -magnitude;
+
+	uint64_t marker_bit = (uint64_t(1) << (addr & 63));
+	uint64_t &markers = loop_markers[(addr >> 6)];
+	markers = (data == 0xFF) ? (markers | marker_bit) : (markers & ~marker_bit);
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::writereg(uint8_t reg, uint8_t data)
     {
 	auto &channel = rf5c68_channels[ch_bank];
 
@@ -258,7 +411,207 @@ namespace beepcm
 	}
     }
 
-    void RF5C68::clockchip()
+    // Advances the channel past a sample that isn't a loop marker and outputs it
+    template<RF5CType chip_type>
+    inline void RF5CChip<chip_type>::play_sample(rf5c68_channel &channel, int8_t sample)
+    {
+	int left_vol = ((channel.pan & 0xF) * channel.envelope);
+	int right_vol = ((channel.pan >> 4) * channel.envelope);
+
+	channel.current_addr = ((channel.current_addr + channel.step) & 0x7FFFFFF);
+
+	channel.output[0] = ((sample * left_vol) >> 5);
+	channel.output[1] = ((sample * right_vol) >> 5);
+    }
+
+    // Returns how many samples the channel can play before it reaches a loop marker
+    // (0 if it is on one now, or 0xFFFFFFFF if there isn't one within max_distance bytes)
+    template<RF5CType chip_type>
+    uint32_t RF5CChip<chip_type>::samples_until_marker(rf5c68_channel &channel, uint32_t max_distance)
+    {
+	const uint32_t endless = 0xFFFFFFFF;
+	uint32_t ram_addr = (channel.current_addr >> 11);
+
+	// Find the distance to the nearest marker at or after the current address,
+	// wrapping around the end of wave RAM
+	uint32_t distance = endless;
+	uint32_t word_index = (ram_addr >> 6);
+	uint64_t markers = (loop_markers[word_index] & (~uint64_t(0) << (ram_addr & 63)));
+	uint32_t num_words = min<uint32_t>((((ram_addr & 63) + max_distance) >> 6), loop_markers.size());
+
+	for (uint32_t i = 0; i <= num_words; i++)
+	{
+	    if (markers != 0)
+	    {
+		uint32_t bit = 0;
+
+		while (!testbit(markers, bit))
+		{
+		    bit += 1;
+		}
+
+		uint32_t marker_addr = ((((word_index + i) << 6) + bit) & 0xFFFF);
+		distance = ((marker_addr - ram_addr) & 0xFFFF);
+		break;
+	    }
+
+	    markers = loop_markers[((word_index + i + 1) % loop_markers.size())];
+	}
+
+	if (distance == 0)
+	{
+	    return 0;
+	}
+
+	if (distance == endless)
+	{
+	    return endless;
+	}
+
+	return samples_until_addr(channel, (ram_addr + distance));
+    }
+
+    // Returns how many samples the channel can play before its address reaches ram_addr
+    // (which must be after the current address, but may be past the end of RAM)
+    template<RF5CType chip_type>
+    uint32_t RF5CChip<chip_type>::samples_until_addr(rf5c68_channel &channel, uint32_t ram_addr)
+    {
+	const uint32_t endless = 0xFFFFFFFF;
+
+	if (channel.step == 0)
+	{
+	    return endless;
+	}
+
+	uint64_t target_offs = (uint64_t(ram_addr) << 11);
+	uint64_t num_samples = ((target_offs - channel.current_addr + channel.step - 1) / channel.step);
+	return uint32_t(min<uint64_t>(num_samples, endless));
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::render_channel(rf5c68_channel &channel, int32_t *buffer, int num_samples)
+    {
+	int index = 0;
+
+	while (index < num_samples)
+	{
+	    // Only look as far ahead as the channel can get in the rest of the buffer
+	    uint32_t max_distance = uint32_t(min<uint64_t>(((uint64_t(num_samples - index) * channel.step) >> 11) + 1, 0x10000));
+	    uint32_t run_length = samples_until_marker(channel, max_distance);
+
+	    if (run_length == 0)
+	    {
+		// The channel is on a loop marker, so jump back to the loop start
+		channel.current_addr = (channel.loop_start << 11);
+		uint8_t sample_val = rf5c68_ram[channel.loop_start];
+
+		if (sample_val == 0xFF)
+		{
+		    // The channel is stuck on the marker until its registers are changed
+		    for (; index < num_samples; index++)
+		    {
+			buffer[(index * 2)] += clamp<int16_t>(channel.output[0], -32768, 32767);
+			buffer[(index * 2) + 1] += clamp<int16_t>(channel.output[1], -32768, 32767);
+		    }
+
+		    break;
+		}
+
+		run_length = 1;
+	    }
+
+	    // None of the samples in this run can be a loop marker,
+	    // so each one is just a load and multiply
+	    // (a 7-bit sample times an 8-bit volume and 4-bit pan never needs clamping)
+	    int run_end = int(min<uint32_t>(run_length, (num_samples - index))) + index;
+	    int left_vol = ((channel.pan & 0xF) * channel.envelope);
+	    int right_vol = ((channel.pan >> 4) * channel.envelope);
+	    uint32_t current_addr = channel.current_addr;
+	    int32_t sample = 0;
+
+	    for (; index < run_end; index++)
+	    {
+		sample = signed_ram[((current_addr >> 11) & 0xFFFF)];
+		current_addr = ((current_addr + channel.step) & 0x7FFFFFF);
+		buffer[(index * 2)] += ((sample * left_vol) >> 5);
+		buffer[(index * 2) + 1] += ((sample * right_vol) >> 5);
+	    }
+
+	    channel.current_addr = current_addr;
+	    channel.output[0] = ((sample * left_vol) >> 5);
+	    channel.output[1] = ((sample * right_vol) >> 5);
+	}
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::render(int32_t *buffer, int num_samples)
+    {
+	if (!is_vgm_hack || !rf5c68_enable)
+	{
+	    render_block(buffer, num_samples);
+	    return;
+	}
+
+	// The VGM hack adjusts the stream based on where each channel is,
+	// so render in runs where it can't, and clock one sample at a time in between
+	int index = 0;
+
+	while (index < num_samples)
+	{
+	    uint32_t run_length = min<uint32_t>(vgm_safe_samples(), (num_samples - index));
+
+	    if (run_length == 0)
+	    {
+		clockchip();
+		auto samples = get_samples();
+		buffer[(index * 2)] = samples[0];
+		buffer[(index * 2) + 1] = samples[1];
+		index += 1;
+		continue;
+	    }
+
+	    render_block(&buffer[(index * 2)], run_length);
+	    advance_vgm(run_length);
+	    index += run_length;
+	}
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::render_block(int32_t *buffer, int num_samples)
+    {
+	fill(buffer, (buffer + (num_samples * 2)), 0);
+
+	for (auto &channel : rf5c68_channels)
+	{
+	    if (rf5c68_enable && channel.is_enable)
+	    {
+		render_channel(channel, buffer, num_samples);
+		continue;
+	    }
+
+	    // Channels that aren't being clocked keep outputting their last sample
+	    int32_t left_sample = clamp<int16_t>(channel.output[0], -32768, 32767);
+	    int32_t right_sample = clamp<int16_t>(channel.output[1], -32768, 32767);
+
+	    for (int index = 0; index < num_samples; index++)
+	    {
+		buffer[(index * 2)] += left_sample;
+		buffer[(index * 2) + 1] += right_sample;
+	    }
+	}
+
+	// Output is only 10 bits on the RF5C68
+	if constexpr (chip_type == RF5CType::RF5C68_Chip)
+	{
+	    for (int index = 0; index < (num_samples * 2); index++)
+	    {
+		buffer[index] &= ~0x3F;
+	    }
+	}
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::clockchip()
     {
 	if (!rf5c68_enable)
 	{
@@ -269,9 +622,6 @@ namespace beepcm
 	{
 	    if (channel.is_enable)
 	    {
-		int left_vol = ((channel.pan & 0xF) * channel.envelope);
-		int right_vol = ((channel.pan >> 4) * channel.envelope);
-
 		check_vgm_samples(((channel.current_addr >> 11) & 0xFFFF), channel.step);
 		uint8_t sample_val = rf5c68_ram.at(((channel.current_addr >> 11) & 0xFFFF));
 
@@ -286,50 +636,26 @@ namespace beepcm
 		    }
 		}
 
-		channel.current_addr = ((channel.current_addr + channel.step) & 0x7FFFFFF);
-
-		int8_t sample = 0;
-
-		if (testbit(sample_val, 7))
-		{
-		    sample = (sample_val & 0x7F);
-		}
-		else
-		{
-		    sample = -(sample_val & 0x7F);
-		}
-
-		channel.output[0] = ((sample * left_vol) >> 5);
-		channel.output[1] = ((sample * right_vol) >> 5);
+		play_sample(channel, signed_ram[((channel.current_addr >> 11) & 0xFFFF)]);
 	    }
 	}
 
 	if (is_vgm_hack)
 	{
-	    if (vgm_cur_addr < vgm_end_addr)
-	    {
-		vgm_cur_step += 0x800;
-
-		if (vgm_cur_step >= 0x800)
-		{
-		    uint32_t vgm_pos = (vgm_cur_step >> 11);
-		    vgm_cur_step &= 0x7FF;
-
-		    if ((vgm_cur_addr + vgm_pos) > vgm_end_addr)
-		    {
-			vgm_pos = (vgm_end_addr - vgm_cur_addr);
-		    }
-
-		    auto begin = (vgm_data.begin() + (vgm_cur_addr - vgm_base_addr));
-		    auto end = (begin + vgm_pos);
-		    copy(begin, end, (rf5c68_ram.begin() + vgm_cur_addr));
-		    vgm_cur_addr += vgm_pos;
-		}
-	    }
+	    advance_vgm(1);
 	}
     }
 
-    vector<int32_t> RF5C68::get_samples()
+    template<RF5CType chip_type>
+    vector<int32_t> RF5CChip<chip_type>::get_samples()
+    {
+	vector<int32_t> final_samples(2, 0);
+	get_samples(final_samples.data());
+	return final_samples;
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::get_samples(int32_t *samples)
     {
 	array<int32_t, 2> mixed_samples = {0, 0};
 
@@ -347,16 +673,83 @@ namespace beepcm
 
 	// Output is only 10 bits on the RF5C68,
 	// but 16 bits on the RF5C164
-	if (true)
-	// if (chip_type == RF5CType::RF5C68_Chip)
+	if constexpr (chip_type == RF5CType::RF5C68_Chip)
 	{
 	    mixed_samples[0] &= ~0x3F;
 	    mixed_samples[1] &= ~0x3F;
 	}
 
-	vector<int32_t> final_samples;
-	final_samples.push_back(mixed_samples[0]);
-	final_samples.push_back(mixed_samples[1]);
-	return final_samples;
+	samples[0] = mixed_samples[0];
+	samples[1] = mixed_samples[1];
+    }
+
+
+    // The wave RAM and VGM block are handled separately,
+    // as the RAM's lookup tables and the block's pointer need updating on load
+    template<RF5CType chip_type>
+    template<typename State>
+    void RF5CChip<chip_type>::sync_state(State &state)
+    {
+	state.sync(rf5c68_channels);
+	state.sync(rf5c68_enable);
+	state.sync(mem_bank);
+	state.sync(ch_bank);
+	state.sync(is_vgm_hack);
+	state.sync(vgm_base_addr);
+	state.sync(vgm_cur_addr);
+	state.sync(vgm_end_addr);
+    }
+
+    template<RF5CType chip_type>
+    vector<uint8_t> RF5CChip<chip_type>::save_state()
+    {
+	vector<uint8_t> state;
+	save_state(state);
+	return state;
+    }
+
+    // RF5C68 and RF5C164 states aren't interchangeable, as their outputs differ
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::save_state(vector<uint8_t> &state)
+    {
+	const char *chip_tag = (chip_type == RF5CType::RF5C164_Chip) ? "R164" : "RF68";
+	StateWriter writer(chip_tag, state_version, 0, move(state));
+	sync_state(writer);
+	writer.write(rf5c68_ram);
+
+	uint32_t vgm_length = (vgm_data != nullptr) ? (vgm_end_addr - vgm_base_addr) : 0;
+	writer.write(vgm_length);
+	writer.write_bytes(vgm_data, vgm_length);
+	state = writer.get_state();
+    }
+
+    template<RF5CType chip_type>
+    void RF5CChip<chip_type>::load_state(const vector<uint8_t> &state)
+    {
+	const char *chip_tag = (chip_type == RF5CType::RF5C164_Chip) ? "R164" : "RF68";
+	StateReader reader(state, chip_tag, state_version, 0);
+	sync_state(reader);
+
+	// Only the 64-byte lines of RAM that differ from the state are written,
+	// as converting all 64 KB again would make restoring a recent state (e.g. for run-ahead) very slow
+	const uint8_t *ram_data = reader.read_block(rf5c68_ram.size());
+
+	for (uint32_t addr = 0; addr < rf5c68_ram.size(); addr += 64)
+	{
+	    if (memcmp(&rf5c68_ram[addr], &ram_data[addr], 64) != 0)
+	    {
+		update_ram(addr, &ram_data[addr], 64);
+	    }
+	}
+
+	// The block being streamed is kept in vgm_buffer from here on
+	uint32_t vgm_length = 0;
+	reader.read(vgm_length);
+	const uint8_t *vgm_block = reader.read_block(vgm_length);
+	vgm_buffer.assign(vgm_block, (vgm_block + vgm_length));
+	vgm_data = (vgm_length != 0) ? vgm_buffer.data() : nullptr;
+	reader.finish();
     }
+    template class RF5CChip<RF5CType::RF5C68_Chip>;
+    template class RF5CChip<RF5CType::RF5C164_Chip>;
 };
\ No newline at end of file
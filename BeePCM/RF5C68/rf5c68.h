@@ -27,26 +27,66 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include "savestate.h"
 using namespace std;
 
 namespace beepcm
 {
-    class RF5C68
+    enum class RF5CType : int
+    {
+	RF5C68_Chip = 0,
+	RF5C164_Chip = 1,
+    };
+
+    // The RF5C164 is an RF5C68 with a 16-bit output stage,
+    // so the chip type is a template parameter rather than something checked per sample
+    template<RF5CType chip_type>
+    class RF5CChip
     {
 	public:
-	    RF5C68();
-	    ~RF5C68();
+	    RF5CChip();
+	    ~RF5CChip();
+
+	    // The VGM hack can stream from this chip's own copy of a block, so copying a chip isn't allowed
+	    // (use save_state() and load_state() on another chip of the same type instead)
+	    RF5CChip(const RF5CChip&) = delete;
+	    RF5CChip &operator=(const RF5CChip&) = delete;
 
 	    uint32_t get_sample_rate(uint32_t clock_rate);
 	    void init();
 	    void enable_vgm_hack(bool is_enabled = true);
 	    void writeRAM(int data_start, int data_len, vector<uint8_t> ram_data);
+
+	    // Same as above, but with the VGM hack enabled, the data is streamed straight from ram_data,
+	    // which must stay valid until the next call to writeRAM()
+	    void writeRAM(int data_start, int data_len, const uint8_t *ram_data);
+
 	    void writemem(uint16_t addr, uint8_t data);
+
+	    // Equivalent to calling writemem() for each byte of data
+	    // (so the address wraps around within the current 4 KB bank)
+	    void writemem(uint16_t addr, const uint8_t *data, size_t length);
 	    void writereg(uint8_t reg, uint8_t data);
 
 	    void clockchip();
 	    vector<int32_t> get_samples();
 
+	    // Same as above, but writes the left and right samples to samples[0] and samples[1]
+	    void get_samples(int32_t *samples);
+
+	    // Saves the channels and wave RAM (along with the rest of any block being streamed by the VGM hack),
+	    // and loads a state saved by a chip of the same type
+	    vector<uint8_t> save_state();
+	    void load_state(const vector<uint8_t> &state);
+
+	    // Same as save_state(), but reuses the storage of state,
+	    // so that a state can be saved every frame (e.g. for run-ahead) without allocating
+	    void save_state(vector<uint8_t> &state);
+
+	    // Renders num_samples samples into buffer (as interleaved left/right pairs),
+	    // with the same results as calling clockchip() and get_samples() for each sample
+	    void render(int32_t *buffer, int num_samples);
+
 	private:
 	    template<typename T>
 	    bool testbit(T reg, int bit)
@@ -56,6 +96,11 @@ namespace beepcm
 
 	    void reset();
 
+	    static constexpr uint32_t state_version = 1;
+
+	    template<typename State>
+	    void sync_state(State &state);
+
 	    struct rf5c68_channel
 	    {
 		uint8_t envelope = 0;
@@ -72,20 +117,42 @@ namespace beepcm
 	    array<uint8_t, 0x10000> rf5c68_ram;
 	    bool rf5c68_enable = false;
 
+	    // Wave RAM converted from sign-magnitude to signed samples
+	    array<int8_t, 0x10000> signed_ram;
+
+	    // One bit for each byte of wave RAM that holds a loop marker (0xFF)
+	    array<uint64_t, (0x10000 / 64)> loop_markers;
+
+	    // Both of the above are kept up to date by every RAM write
+	    void update_ram(uint32_t addr, const uint8_t *data, uint32_t length);
+	    void write_ram_byte(uint32_t addr, uint8_t data);
+	    uint32_t samples_until_marker(rf5c68_channel &channel, uint32_t max_distance = 0x10000);
+	    uint32_t samples_until_addr(rf5c68_channel &channel, uint32_t ram_addr);
+	    void play_sample(rf5c68_channel &channel, int8_t sample);
+	    void render_channel(rf5c68_channel &channel, int32_t *buffer, int num_samples);
+	    void render_block(int32_t *buffer, int num_samples);
+
 	    int mem_bank = 0;
 	    int ch_bank = 0;
 
 	    bool is_vgm_hack = false;
 
+	    // The VGM hack streams each block into RAM one byte per sample,
+	    // reading it from vgm_data (which points either to the caller's buffer or vgm_buffer)
 	    uint32_t vgm_base_addr = 0;
 	    uint32_t vgm_cur_addr = 0;
 	    uint32_t vgm_end_addr = 0;
-	    uint16_t vgm_cur_step = 0;
-	    vector<uint8_t> vgm_data;
+	    const uint8_t *vgm_data = nullptr;
+	    vector<uint8_t> vgm_buffer;
 
 	    void check_vgm_samples(uint32_t addr, uint16_t speed);
 	    void flush_vgm();
+	    void advance_vgm(uint32_t num_samples);
+	    uint32_t vgm_safe_samples();
     };
+
+    using RF5C68 = RF5CChip<RF5CType::RF5C68_Chip>;
+    using RF5C164 = RF5CChip<RF5CType::RF5C164_Chip>;
 };
 
 #endif // BEEPCM_RF5C68
\ No newline at end of file
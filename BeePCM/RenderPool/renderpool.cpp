@@ -0,0 +1,213 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-RenderPool
+//
+// Streams don't share any state, so each block of each stream can be rendered on any thread.
+// How long a block takes varies a lot between chips (a busy MultiPCM takes far longer than an OKIM6295),
+// so rather than splitting the streams up between the threads in advance,
+// every worker has its own queue, and any worker that runs out of jobs steals them from the others.
+//
+// Workers take jobs from the front of their own queue and steal from the back of everyone else's,
+// so that a worker and a thief only fight over the same job when there's one left.
+
+#include "renderpool.h"
+using namespace beepcm;
+
+namespace beepcm
+{
+    // Worker that the current thread belongs to (if any)
+    static thread_local RenderPool *current_pool = nullptr;
+    static thread_local int current_worker = -1;
+
+    int32_t *renderpool_scratch::get_buffer(size_t num_samples)
+    {
+	// Leave room to move the start of the buffer up to the next cache line
+	size_t padding = (64 / sizeof(int32_t));
+
+	if (storage.size() < (num_samples + padding))
+	{
+	    storage.resize(num_samples + padding);
+	}
+
+	uintptr_t addr = reinterpret_cast<uintptr_t>(storage.data());
+	uintptr_t aligned_addr = ((addr + 63) & ~uintptr_t(63));
+	return reinterpret_cast<int32_t*>(aligned_addr);
+    }
+
+    RenderPool::RenderPool(int num_threads) : next_worker(0), num_queued(0)
+    {
+	if (num_threads <= 0)
+	{
+	    num_threads = max<int>(1, thread::hardware_concurrency());
+	}
+
+	for (int i = 0; i < num_threads; i++)
+	{
+	    workers.push_back(make_unique<renderpool_worker>());
+	}
+
+	for (int i = 0; i < num_threads; i++)
+	{
+	    workers[i]->worker_thread = thread(&RenderPool::worker_loop, this, i);
+	}
+    }
+
+    RenderPool::~RenderPool()
+    {
+	{
+	    lock_guard<mutex> lock(state_mutex);
+	    is_stopping = true;
+	}
+
+	work_available.notify_all();
+
+	for (auto &worker : workers)
+	{
+	    worker->worker_thread.join();
+	}
+    }
+
+    int RenderPool::get_num_threads()
+    {
+	return int(workers.size());
+    }
+
+    future<void> RenderPool::submit(renderjobfunc job)
+    {
+	renderpool_task task(move(job));
+	future<void> result = task.get_future();
+
+	bool is_nested = (current_pool == this);
+	int worker_index = is_nested ? current_worker : int(next_worker.fetch_add(1) % workers.size());
+	auto &worker = *workers[worker_index];
+
+	{
+	    lock_guard<mutex> lock(state_mutex);
+
+	    if (is_stopping)
+	    {
+		throw runtime_error("RenderPool is shutting down");
+	    }
+
+	    // num_queued is counted before the task is pushed, so that a worker that takes
+	    // the task straight away can't decrement it below 0. Doing so under the lock means that
+	    // a worker can't miss the notification between checking num_queued and going to sleep
+	    // (at worst, a worker woken before the push finds nothing and checks again)
+	    num_unfinished += 1;
+	    num_queued += 1;
+	}
+
+	{
+	    lock_guard<mutex> lock(worker.queue_mutex);
+
+	    if (is_nested)
+	    {
+		worker.tasks.push_front(move(task));
+	    }
+	    else
+	    {
+		worker.tasks.push_back(move(task));
+	    }
+	}
+
+	work_available.notify_one();
+	return result;
+    }
+
+    void RenderPool::wait_idle()
+    {
+	unique_lock<mutex> lock(state_mutex);
+	work_finished.wait(lock, [&]() { return (num_unfinished == 0); });
+    }
+
+    // Takes a job from the worker's own queue, or failing that, steals one from another worker
+    bool RenderPool::pop_task(int worker_index, renderpool_task &task)
+    {
+	int num_workers = int(workers.size());
+
+	for (int i = 0; i < num_workers; i++)
+	{
+	    int victim_index = ((worker_index + i) % num_workers);
+	    auto &victim = *workers[victim_index];
+	    lock_guard<mutex> lock(victim.queue_mutex);
+
+	    if (victim.tasks.empty())
+	    {
+		continue;
+	    }
+
+	    if (victim_index == worker_index)
+	    {
+		task = move(victim.tasks.front());
+		victim.tasks.pop_front();
+	    }
+	    else
+	    {
+		task = move(victim.tasks.back());
+		victim.tasks.pop_back();
+	    }
+
+	    num_queued -= 1;
+	    return true;
+	}
+
+	return false;
+    }
+
+    void RenderPool::worker_loop(int worker_index)
+    {
+	current_pool = this;
+	current_worker = worker_index;
+	auto &scratch = workers[worker_index]->scratch;
+
+	while (true)
+	{
+	    renderpool_task task;
+
+	    if (pop_task(worker_index, task))
+	    {
+		// Any exception is stored in the job's future
+		task(scratch);
+
+		bool is_idle = false;
+
+		{
+		    lock_guard<mutex> lock(state_mutex);
+		    num_unfinished -= 1;
+		    is_idle = (num_unfinished == 0);
+		}
+
+		if (is_idle)
+		{
+		    work_finished.notify_all();
+		}
+
+		continue;
+	    }
+
+	    unique_lock<mutex> lock(state_mutex);
+	    work_available.wait(lock, [&]() { return (is_stopping || (num_queued != 0)); });
+
+	    if (is_stopping && (num_queued == 0))
+	    {
+		return;
+	    }
+	}
+    }
+};
\ No newline at end of file
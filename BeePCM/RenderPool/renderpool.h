@@ -0,0 +1,107 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEEPCM_RENDERPOOL
+#define BEEPCM_RENDERPOOL
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+using namespace std;
+
+namespace beepcm
+{
+    // Scratch memory belonging to one worker thread, which is handed to every job it runs
+    // (so that jobs don't need to allocate their own buffers)
+    class alignas(64) renderpool_scratch
+    {
+	public:
+	    // Returns a 64-byte aligned buffer of at least num_samples samples,
+	    // which stays valid until the next call or the end of the job
+	    int32_t *get_buffer(size_t num_samples);
+
+	private:
+	    vector<int32_t> storage;
+    };
+
+    // A job renders one block of a stream (i.e. N frames of each of that stream's chips),
+    // and must not touch chips belonging to jobs that may be running at the same time
+    using renderjobfunc = function<void(renderpool_scratch &)>;
+
+    // Runs render jobs on a fixed set of worker threads,
+    // with idle workers taking jobs from the back of busy workers' queues
+    class RenderPool
+    {
+	public:
+	    // A thread count of 0 uses one thread per hardware thread
+	    RenderPool(int num_threads = 0);
+
+	    // Finishes all of the queued jobs before stopping the workers
+	    ~RenderPool();
+
+	    // Queues a job and returns a future that becomes ready once it has run
+	    // (and rethrows any exception the job threw)
+	    future<void> submit(renderjobfunc job);
+
+	    // Waits for every job queued so far to finish
+	    // (must not be called from inside a job)
+	    void wait_idle();
+
+	    int get_num_threads();
+
+	private:
+	    using renderpool_task = packaged_task<void(renderpool_scratch &)>;
+
+	    // Each worker's queue is on its own cache line, so that
+	    // workers only contend with each other when stealing
+	    struct alignas(64) renderpool_worker
+	    {
+		mutex queue_mutex;
+		deque<renderpool_task> tasks;
+		renderpool_scratch scratch;
+		thread worker_thread;
+	    };
+
+	    vector<unique_ptr<renderpool_worker>> workers;
+
+	    void worker_loop(int worker_index);
+	    bool pop_task(int worker_index, renderpool_task &task);
+
+	    // Jobs submitted from outside the pool are spread across the workers in turn,
+	    // while jobs submitted from inside a job go to the front of that worker's own queue
+	    atomic<uint32_t> next_worker;
+
+	    mutex state_mutex;
+	    condition_variable work_available;
+	    condition_variable work_finished;
+	    atomic<size_t> num_queued;
+	    size_t num_unfinished = 0;
+	    bool is_stopping = false;
+    };
+};
+
+#endif // BEEPCM_RENDERPOOL
\ No newline at end of file
@@ -0,0 +1,234 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-Resampler
+//
+// Each output frame is a windowed sinc interpolation of the input frames around it.
+// The filter is stored as a table of num_phases sets of coefficients,
+// with the coefficients for an output frame being linearly interpolated
+// between the two phases closest to its position.
+//
+// The history is stored separately for each channel, so that each output sample
+// is a straight dot product that the compiler can vectorize.
+
+#include "resampler.h"
+using namespace beepcm;
+
+namespace beepcm
+{
+    Resampler::Resampler()
+    {
+
+    }
+
+    Resampler::~Resampler()
+    {
+
+    }
+
+    // Filter tables only depend on the rates and filter length,
+    // so they're shared between all instances for the lifetime of the process
+    const Resampler::resampler_filter *Resampler::get_filter(uint32_t input_rate, uint32_t output_rate, int filter_length)
+    {
+	static mutex cache_mutex;
+	static map<array<uint32_t, 3>, unique_ptr<resampler_filter>> cached_filters;
+
+	lock_guard<mutex> lock(cache_mutex);
+
+	auto &filter = cached_filters[{input_rate, output_rate, uint32_t(filter_length)}];
+
+	if (!filter)
+	{
+	    filter = make_unique<resampler_filter>();
+
+	    // Cut off just below the lower of the two Nyquist frequencies (in cycles per input sample)
+	    double ratio = min(1.0, (double(output_rate) / double(input_rate)));
+	    double cutoff = (0.45 * ratio);
+
+	    // Keep the number of taps a multiple of 8 for the dot product
+	    int num_taps = int(ceil(double(filter_length) / ratio));
+	    num_taps = ((num_taps + 7) & ~7);
+	    filter->num_taps = num_taps;
+	    filter->coefficients.resize(((num_phases + 1) * num_taps), 0.0f);
+
+	    const double pi = 3.14159265358979323846;
+	    int half_taps = (num_taps / 2);
+
+	    for (int phase = 0; phase <= num_phases; phase++)
+	    {
+		double phase_offs = (double(phase) / double(num_phases));
+		float *phase_coeffs = &filter->coefficients[(phase * num_taps)];
+		double sum = 0.0;
+
+		for (int tap = 0; tap < num_taps; tap++)
+		{
+		    // Distance (in input samples) from the output frame to this tap's input frame
+		    double time = (double(half_taps - 1 - tap) + phase_offs);
+		    double sinc = (time == 0.0) ? 1.0 : (sin(2.0 * pi * cutoff * time) / (2.0 * pi * cutoff * time));
+
+		    // Blackman window over the full width of the filter
+		    double window_pos = ((time / double(half_taps)) + 1.0) * 0.5;
+		    double window = 0.0;
+
+		    if ((window_pos > 0.0) && (window_pos < 1.0))
+		    {
+			window = (0.42 - (0.5 * cos(2.0 * pi * window_pos)) + (0.08 * cos(4.0 * pi * window_pos)));
+		    }
+
+		    double coeff = (sinc * window);
+		    phase_coeffs[tap] = float(coeff);
+		    sum += coeff;
+		}
+
+		// Normalize each phase for unity gain at DC
+		for (int tap = 0; tap < num_taps; tap++)
+		{
+		    phase_coeffs[tap] = float(phase_coeffs[tap] / sum);
+		}
+	    }
+	}
+
+	return filter.get();
+    }
+
+    void Resampler::configure(uint32_t input_rate, uint32_t output_rate, int num_channels, int filter_length)
+    {
+	if ((input_rate == 0) || (output_rate == 0))
+	{
+	    throw runtime_error("Resampler rates can not be 0");
+	}
+
+	if (num_channels <= 0)
+	{
+	    throw runtime_error("Resampler needs at least one channel");
+	}
+
+	filter = get_filter(input_rate, output_rate, max(filter_length, 1));
+	num_taps = filter->num_taps;
+	this->num_channels = num_channels;
+	position_step = ((uint64_t(input_rate) << 32) / output_rate);
+	phase_coefficients.assign(num_taps, 0.0f);
+	reset();
+    }
+
+    void Resampler::reset()
+    {
+	// Start with a full filter's worth of silence, with the first output frame
+	// lined up with the middle of it (so the output lags the input by latency() input frames)
+	history.assign(num_channels, vector<float>(num_taps, 0.0f));
+	position = (uint64_t(latency()) << 32);
+    }
+
+    int Resampler::latency()
+    {
+	return (num_taps / 2);
+    }
+
+    int Resampler::max_output_frames(int num_input_frames)
+    {
+	if (position_step == 0)
+	{
+	    return 0;
+	}
+
+	uint64_t end_position = (uint64_t(history.empty() ? 0 : history[0].size() + num_input_frames) << 32);
+	return int(((end_position - min(end_position, position)) / position_step) + 1);
+    }
+
+    int Resampler::process(const int32_t *input, int num_input_frames, int32_t *output)
+    {
+	if (filter == nullptr)
+	{
+	    throw runtime_error("Resampler has not been configured");
+	}
+
+	for (int channel = 0; channel < num_channels; channel++)
+	{
+	    auto &channel_history = history[channel];
+	    size_t history_size = channel_history.size();
+	    channel_history.resize(history_size + num_input_frames);
+
+	    for (int index = 0; index < num_input_frames; index++)
+	    {
+		channel_history[history_size + index] = float(input[(index * num_channels) + channel]);
+	    }
+	}
+
+	int half_taps = (num_taps / 2);
+	uint64_t history_length = history[0].size();
+	int num_output_frames = 0;
+
+	while (true)
+	{
+	    uint64_t frame_index = (position >> 32);
+	    uint64_t first_tap = (frame_index - (half_taps - 1));
+
+	    if ((first_tap + num_taps) > history_length)
+	    {
+		break;
+	    }
+
+	    // Interpolate between the two nearest phases
+	    uint64_t phase_pos = ((position & 0xFFFFFFFF) * num_phases);
+	    int phase = int(phase_pos >> 32);
+	    float phase_frac = (float(phase_pos & 0xFFFFFFFF) / 4294967296.0f);
+
+	    const float *coeffs = &filter->coefficients[(phase * num_taps)];
+	    const float *next_coeffs = (coeffs + num_taps);
+	    float *interp_coeffs = phase_coefficients.data();
+
+	    for (int tap = 0; tap < num_taps; tap++)
+	    {
+		interp_coeffs[tap] = (coeffs[tap] + ((next_coeffs[tap] - coeffs[tap]) * phase_frac));
+	    }
+
+	    for (int channel = 0; channel < num_channels; channel++)
+	    {
+		const float *samples = &history[channel][first_tap];
+
+		// Eight separate sums, so that the compiler can keep them in vector registers
+		array<float, 8> sums = {};
+
+		for (int tap = 0; tap < num_taps; tap += 8)
+		{
+		    for (int lane = 0; lane < 8; lane++)
+		    {
+			sums[lane] += (interp_coeffs[tap + lane] * samples[tap + lane]);
+		    }
+		}
+
+		float sample = (((sums[0] + sums[4]) + (sums[1] + sums[5])) + ((sums[2] + sums[6]) + (sums[3] + sums[7])));
+		output[(num_output_frames * num_channels) + channel] = int32_t(lrintf(sample));
+	    }
+
+	    num_output_frames += 1;
+	    position += position_step;
+	}
+
+	// Drop the input frames that no future output frame needs
+	uint64_t first_needed = min<uint64_t>(((position >> 32) - (half_taps - 1)), history_length);
+
+	for (auto &channel_history : history)
+	{
+	    channel_history.erase(channel_history.begin(), (channel_history.begin() + first_needed));
+	}
+
+	position -= (first_needed << 32);
+	return num_output_frames;
+    }
+};
\ No newline at end of file
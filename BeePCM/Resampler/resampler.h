@@ -0,0 +1,89 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEEPCM_RESAMPLER
+#define BEEPCM_RESAMPLER
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+namespace beepcm
+{
+    // Converts blocks of samples from a chip's native sample rate to another rate
+    // using a band-limited (windowed sinc) polyphase filter
+    class Resampler
+    {
+	public:
+	    Resampler();
+	    ~Resampler();
+
+	    // Sets up conversion of num_channels interleaved channels from input_rate to output_rate.
+	    // filter_length is the number of filter taps used when the rates are equal
+	    // (more taps give a sharper filter for more CPU time, with 8 to 64 being sensible),
+	    // and is scaled up when downsampling so that the filter's cutoff stays just as sharp
+	    void configure(uint32_t input_rate, uint32_t output_rate, int num_channels = 2, int filter_length = 16);
+
+	    // Clears the filter history
+	    void reset();
+
+	    // Number of input frames that the output lags behind the input by
+	    // (half of the filter's taps, which depends on the rates and filter length)
+	    int latency();
+
+	    // Largest number of output frames that process() can produce from num_input_frames frames
+	    int max_output_frames(int num_input_frames);
+
+	    // Resamples num_input_frames frames from input into output (both interleaved),
+	    // and returns the number of frames written to output
+	    int process(const int32_t *input, int num_input_frames, int32_t *output);
+
+	private:
+	    static constexpr int num_phases = 256;
+
+	    // Filter coefficients for each of the phases between two input samples
+	    // (plus one extra phase, so that neighbouring phases can be interpolated between)
+	    struct resampler_filter
+	    {
+		int num_taps = 0;
+		vector<float> coefficients;
+	    };
+
+	    static const resampler_filter *get_filter(uint32_t input_rate, uint32_t output_rate, int filter_length);
+
+	    const resampler_filter *filter = nullptr;
+	    int num_channels = 0;
+	    int num_taps = 0;
+
+	    // Position of the next output frame within the history, as a 32.32 fixed-point input frame index
+	    uint64_t position = 0;
+	    uint64_t position_step = 0;
+
+	    vector<vector<float>> history;
+	    vector<float> phase_coefficients;
+    };
+};
+
+#endif // BEEPCM_RESAMPLER
\ No newline at end of file
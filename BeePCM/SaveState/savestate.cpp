@@ -0,0 +1,164 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// BeePCM-SaveState
+//
+// Save states are laid out as follows (with everything in the host's byte order):
+//
+// 4 bytes - Chip tag (i.e. "MPCM")
+// 4 bytes - Version of the chip's state layout
+// 8 bytes - Hash of the chip's ROM (or 0 for chips without one)
+// 8 bytes - Length of the rest of the state
+//
+// followed by each of the chip's fields, in the order the chip writes them
+// (with each one padded to its alignment, up to 8 bytes).
+// As only the ROM's hash is stored, a state can only be loaded into a chip that has the same ROM loaded.
+//
+// The YMZ280B, RF5C68/RF5C164 and MultiPCM hold pointers into their own buffers, so they can't be copied.
+// To duplicate a chip, save its state and load it into another chip instead.
+
+#include "savestate.h"
+using namespace beepcm;
+
+namespace beepcm
+{
+    static constexpr size_t header_size = 24;
+
+    uint64_t hash_rom(const vector<uint8_t> &rom)
+    {
+	// Works on 8 bytes at a time, so hashing a full 16 MB ROM only takes a few milliseconds
+	const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+	uint64_t hash = (rom.size() * multiplier);
+	size_t num_words = (rom.size() / 8);
+
+	for (size_t i = 0; i < num_words; i++)
+	{
+	    uint64_t word = 0;
+	    memcpy(&word, &rom[(i * 8)], 8);
+	    hash = ((hash ^ word) * multiplier);
+	    hash ^= (hash >> 29);
+	}
+
+	for (size_t i = (num_words * 8); i < rom.size(); i++)
+	{
+	    hash = ((hash ^ rom[i]) * multiplier);
+	    hash ^= (hash >> 29);
+	}
+
+	return hash;
+    }
+
+    void rom_hash_cache::invalidate()
+    {
+	is_valid = false;
+    }
+
+    uint64_t rom_hash_cache::get_hash(const vector<uint8_t> &rom)
+    {
+	if (!is_valid)
+	{
+	    hash = hash_rom(rom);
+	    is_valid = true;
+	}
+
+	return hash;
+    }
+
+    StateWriter::StateWriter(const char *chip_tag, uint32_t version, uint64_t rom_hash)
+    {
+	write_header(chip_tag, version, rom_hash);
+    }
+
+    StateWriter::StateWriter(const char *chip_tag, uint32_t version, uint64_t rom_hash, vector<uint8_t> &&buffer) : state(move(buffer))
+    {
+	write_header(chip_tag, version, rom_hash);
+    }
+
+    StateWriter::~StateWriter()
+    {
+
+    }
+
+    void StateWriter::write_header(const char *chip_tag, uint32_t version, uint64_t rom_hash)
+    {
+	uint64_t length = 0;
+	write_bytes(chip_tag, 4);
+	write(version);
+	write(rom_hash);
+	write(length);
+    }
+
+
+    vector<uint8_t> StateWriter::get_state()
+    {
+	state.resize(position);
+	uint64_t length = (state.size() - header_size);
+	memcpy(&state[16], &length, 8);
+	return move(state);
+    }
+
+    StateReader::StateReader(const vector<uint8_t> &state, const char *chip_tag, uint32_t version, uint64_t rom_hash) : state(state)
+    {
+	if (state.size() < header_size)
+	{
+	    throw runtime_error("Save state is too short");
+	}
+
+	if (memcmp(state.data(), chip_tag, 4) != 0)
+	{
+	    throw runtime_error("Save state is for a different chip");
+	}
+
+	uint32_t state_version = 0;
+	uint64_t state_rom_hash = 0;
+	uint64_t length = 0;
+	memcpy(&state_version, &state[4], 4);
+	memcpy(&state_rom_hash, &state[8], 8);
+	memcpy(&length, &state[16], 8);
+
+	if (state_version != version)
+	{
+	    throw runtime_error("Unsupported save state version");
+	}
+
+	if (state_rom_hash != rom_hash)
+	{
+	    throw runtime_error("Save state was made with a different ROM");
+	}
+
+	if (length != (state.size() - header_size))
+	{
+	    throw runtime_error("Save state is truncated");
+	}
+
+	position = header_size;
+    }
+
+    StateReader::~StateReader()
+    {
+
+    }
+
+    void StateReader::finish()
+    {
+	if (position != state.size())
+	{
+	    throw runtime_error("Save state has unexpected data at the end");
+	}
+    }
+};
\ No newline at end of file
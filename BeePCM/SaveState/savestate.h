@@ -0,0 +1,159 @@
+/*
+    This file is part of the BeePCM engine.
+    Copyright (C) 2022 BueniaDev.
+
+    BeePCM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BeePCM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BeePCM.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BEEPCM_SAVESTATE
+#define BEEPCM_SAVESTATE
+
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+
+namespace beepcm
+{
+    // Hash used to identify the ROM a save state was made with, so that the ROM itself doesn't need to be saved
+    uint64_t hash_rom(const vector<uint8_t> &rom);
+
+    // Keeps the hash of a ROM between save states, as it only changes when the ROM is written to
+    class rom_hash_cache
+    {
+	public:
+	    void invalidate();
+	    uint64_t get_hash(const vector<uint8_t> &rom);
+
+	private:
+	    bool is_valid = false;
+	    uint64_t hash = 0;
+    };
+
+    // Builds a save state from plain-old-data fields (each of which is copied as-is),
+    // following a header that identifies the chip, the version of its state layout and its ROM
+    class StateWriter
+    {
+	public:
+	    StateWriter(const char *chip_tag, uint32_t version, uint64_t rom_hash);
+
+	    // Same as above, but builds the state in buffer's storage (which get_state() hands back),
+	    // so that saving into the same buffer every frame doesn't allocate
+	    StateWriter(const char *chip_tag, uint32_t version, uint64_t rom_hash, vector<uint8_t> &&buffer);
+	    ~StateWriter();
+
+	    template<typename T>
+	    void write(const T &value)
+	    {
+		static_assert(is_trivially_copyable<T>::value, "Only plain-old-data can be saved directly");
+
+		// Fields are padded to their alignment (up to 8 bytes),
+		// as copying large fields between misaligned addresses is several times slower
+		size_t alignment = min(alignof(T), size_t(8));
+		uint64_t padding = 0;
+		write_bytes(&padding, ((alignment - (position % alignment)) % alignment));
+		write_bytes(&value, sizeof(T));
+	    }
+
+	    // Same as write(), so that a chip can describe its fields
+	    // with one function that is used for both saving and loading
+	    template<typename T>
+	    void sync(const T &value)
+	    {
+		write(value);
+	    }
+
+	    // Kept inline (along with the reader's equivalents), as a state is made up of many small fields
+	    void write_bytes(const void *data, size_t length)
+	    {
+		// The buffer is only trimmed to the state's length by get_state(),
+		// so saving into a reused buffer never has to resize it here
+		if ((state.size() - position) < length)
+		{
+		    state.resize(max((position + length), (state.size() * 2)));
+		}
+
+		if (length != 0)
+		{
+		    memcpy((state.data() + position), data, length);
+		    position += length;
+		}
+	    }
+
+	    // Finishes the header and returns the save state
+	    vector<uint8_t> get_state();
+
+	private:
+	    vector<uint8_t> state;
+	    size_t position = 0;
+
+	    void write_header(const char *chip_tag, uint32_t version, uint64_t rom_hash);
+    };
+
+    // Reads back a save state written by StateWriter, with the header being checked
+    // (and runtime_error being thrown if it doesn't match) before any fields are read
+    class StateReader
+    {
+	public:
+	    StateReader(const vector<uint8_t> &state, const char *chip_tag, uint32_t version, uint64_t rom_hash);
+	    ~StateReader();
+
+	    template<typename T>
+	    void read(T &value)
+	    {
+		static_assert(is_trivially_copyable<T>::value, "Only plain-old-data can be loaded directly");
+
+		size_t alignment = min(alignof(T), size_t(8));
+		read_block((alignment - (position % alignment)) % alignment);
+		read_bytes(&value, sizeof(T));
+	    }
+
+	    template<typename T>
+	    void sync(T &value)
+	    {
+		read(value);
+	    }
+
+	    void read_bytes(void *data, size_t length)
+	    {
+		memcpy(data, read_block(length), length);
+	    }
+
+	    // Same as read_bytes(), but returns a pointer to the data within the state instead of copying it
+	    const uint8_t *read_block(size_t length)
+	    {
+		if ((state.size() - position) < length)
+		{
+		    throw runtime_error("Save state is truncated");
+		}
+
+		const uint8_t *data = (state.data() + position);
+		position += length;
+		return data;
+	    }
+
+	    // Throws if any of the state was left unread
+	    void finish();
+
+	private:
+	    const vector<uint8_t> &state;
+	    size_t position = 0;
+    };
+};
+
+#endif // BEEPCM_SAVESTATE
\ No newline at end of file
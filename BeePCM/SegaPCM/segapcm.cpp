@@ -79,6 +79,8 @@ namespace beepcm
 
     void SegaPCM::writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data)
     {
+	rom_hash.invalidate();
+
 	pcm_rom.resize(rom_size, 0x80);
 
 	uint32_t data_length = data_len;
@@ -176,7 +178,13 @@ namespace beepcm
 
     vector<int32_t> SegaPCM::get_samples()
     {
-	vector<int32_t> final_samples;
+	vector<int32_t> final_samples(2, 0);
+	get_samples(final_samples.data());
+	return final_samples;
+    }
+
+    void SegaPCM::get_samples(int32_t *samples)
+    {
 	array<int32_t, 2> mixed_samples = {0, 0};
 
 	for (auto &sample : ch_outputs)
@@ -191,9 +199,38 @@ namespace beepcm
 	    }
 	}
 
-	final_samples.push_back(mixed_samples[0]);
-	final_samples.push_back(mixed_samples[1]);
+	samples[0] = mixed_samples[0];
+	samples[1] = mixed_samples[1];
+    }
 
-	return final_samples;
+    template<typename State>
+    void SegaPCM::sync_state(State &state)
+    {
+	state.sync(bank_shift);
+	state.sync(bank_mask);
+	state.sync(pcm_ram);
+	state.sync(low_addr);
+	state.sync(ch_outputs);
+    }
+
+    vector<uint8_t> SegaPCM::save_state()
+    {
+	vector<uint8_t> state;
+	save_state(state);
+	return state;
+    }
+
+    void SegaPCM::save_state(vector<uint8_t> &state)
+    {
+	StateWriter writer("SPCM", state_version, rom_hash.get_hash(pcm_rom), move(state));
+	sync_state(writer);
+	state = writer.get_state();
+    }
+
+    void SegaPCM::load_state(const vector<uint8_t> &state)
+    {
+	StateReader reader(state, "SPCM", state_version, rom_hash.get_hash(pcm_rom));
+	sync_state(reader);
+	reader.finish();
     }
 };
\ No newline at end of file
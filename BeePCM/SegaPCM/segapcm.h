@@ -25,6 +25,7 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include "savestate.h"
 using namespace std;
 
 namespace beepcm
@@ -44,6 +45,18 @@ namespace beepcm
 	    void clockchip();
 	    vector<int32_t> get_samples();
 
+	    // Same as above, but writes the left and right samples to samples[0] and samples[1]
+	    void get_samples(int32_t *samples);
+
+	    // Saves the register RAM and channel state (with the ROM only being identified by its hash),
+	    // and loads a state saved by a SegaPCM with the same ROM
+	    vector<uint8_t> save_state();
+	    void load_state(const vector<uint8_t> &state);
+
+	    // Same as save_state(), but reuses the storage of state,
+	    // so that a state can be saved every frame (e.g. for run-ahead) without allocating
+	    void save_state(vector<uint8_t> &state);
+
 	    void writeROM(vector<uint8_t> rom_data)
 	    {
 		writeROM(rom_data.size(), 0, rom_data.size(), rom_data);
@@ -64,6 +77,12 @@ namespace beepcm
 
 	    void reset();
 
+	    static constexpr uint32_t state_version = 1;
+	    rom_hash_cache rom_hash;
+
+	    template<typename State>
+	    void sync_state(State &state);
+
 	    int bank_shift = 0;
 	    int bank_mask = 0;
 
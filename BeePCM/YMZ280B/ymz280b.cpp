@@ -31,11 +31,8 @@
 //
 // BueniaDev's Notes:
 //
-// Though this core is slowly approaching completion, the following features are still
-// completely unimplemented:
-//
-// IRQ generation
-// External memory handlers
+// Though this core is slowly approaching completion, the DSP registers are still
+// completely unimplemented.
 //
 // In addition, the 16-bit PCM sound generation has not been thoroughly tested as of yet.
 // However, work will be done on all of those fronts, so don't lose hope here!
@@ -46,6 +43,64 @@ using namespace beepcm;
 
 namespace beepcm
 {
+    ymcreative_snapshot_lock::ymcreative_snapshot_lock()
+    {
+	sequence.store(0, memory_order_relaxed);
+	publish(ymcreative_snapshot());
+    }
+
+    void ymcreative_snapshot_lock::publish(const ymcreative_snapshot &snapshot)
+    {
+	array<uint32_t, num_words> buffer = {};
+	memcpy(buffer.data(), &snapshot, sizeof(snapshot));
+
+	// An odd sequence number tells readers that a write is in progress
+	uint32_t seq = sequence.load(memory_order_relaxed);
+	sequence.store((seq + 1), memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	for (size_t i = 0; i < num_words; i++)
+	{
+	    words[i].store(buffer[i], memory_order_relaxed);
+	}
+
+	sequence.store((seq + 2), memory_order_release);
+    }
+
+    ymcreative_snapshot ymcreative_snapshot_lock::read() const
+    {
+	array<uint32_t, num_words> buffer;
+
+	while (true)
+	{
+	    uint32_t seq_begin = sequence.load(memory_order_acquire);
+
+	    if ((seq_begin & 1) != 0)
+	    {
+		continue;
+	    }
+
+	    for (size_t i = 0; i < num_words; i++)
+	    {
+		buffer[i] = words[i].load(memory_order_relaxed);
+	    }
+
+	    atomic_thread_fence(memory_order_acquire);
+
+	    if (sequence.load(memory_order_relaxed) == seq_begin)
+	    {
+		break;
+	    }
+	}
+
+	// Copied through a byte pointer, as the snapshot's default member initializers
+	// make it non-trivial (which memcpy() warns about), even though it's trivially copyable
+	static_assert(is_trivially_copyable<ymcreative_snapshot>::value, "Snapshots must be trivially copyable");
+	ymcreative_snapshot snapshot;
+	memcpy(reinterpret_cast<unsigned char*>(&snapshot), buffer.data(), sizeof(snapshot));
+	return snapshot;
+    }
+
     YMZ280B::YMZ280B()
     {
 
@@ -56,8 +111,9 @@ namespace beepcm
 
     }
 
-    void YMZ280B::update_step(ymcreative_voice &voice)
+    void YMZ280B::update_step(int voice_num)
     {
+	auto &voice = voices[voice_num];
 	int freq_num = 0;
 
 	if (voice.mode == 1)
@@ -69,59 +125,332 @@ namespace beepcm
 	    freq_num = (voice.freq_num & 0x1FF);
 	}
 
-	voice.output_step = (freq_num + 1);
+	if (output_rate == 0)
+	{
+	    voice_lanes.output_step[voice_num] = (freq_num + 1);
+	    return;
+	}
+
+	uint64_t step = (((uint64_t(freq_num + 1) << (pos_bits - 9)) * chip_clock_rate) / (uint64_t(192) * output_rate));
+	voice_lanes.output_step[voice_num] = max<uint32_t>(step, 1);
     }
 
-    void YMZ280B::update_volumes(ymcreative_voice &voice)
+    void YMZ280B::update_volumes(int voice_num)
     {
+	auto &voice = voices[voice_num];
+	auto &output_left = voice_lanes.output_left[voice_num];
+	auto &output_right = voice_lanes.output_right[voice_num];
+
 	if (voice.pan == 8)
 	{
-	    voice.output_left = voice.level;
-	    voice.output_right = voice.level;
+	    output_left = voice.level;
+	    output_right = voice.level;
 	}
 	else if (voice.pan < 8)
 	{
-	    voice.output_left = voice.level;
-	    voice.output_right = (voice.pan == 0) ? 0 : voice.level * (voice.pan - 1) / 7;
+	    output_left = voice.level;
+	    output_right = (voice.pan == 0) ? 0 : voice.level * (voice.pan - 1) / 7;
+	}
+	else
+	{
+	    output_left = voice.level * (15 - voice.pan) / 7;
+	    output_right = voice.level;
+	}
+    }
+
+    void YMZ280B::set_playing(int voice_num, bool is_playing)
+    {
+	voices[voice_num].is_playing = is_playing;
+	voice_lanes.active_mask[voice_num] = is_playing ? 0xFFFFFFFF : 0;
+
+	if (is_playing)
+	{
+	    playing_mask |= (1 << voice_num);
 	}
 	else
 	{
-	    voice.output_left = voice.level * (15 - voice.pan) / 7;
-	    voice.output_right = voice.level;
+	    playing_mask &= ~(1 << voice_num);
 	}
     }
 
-    void YMZ280B::key_on(ymcreative_voice &voice)
+    void YMZ280B::key_on(int voice_num)
     {
-	voice.is_playing = true;
-	voice.current_addr = voice.start_addr;
+	auto &voice = voices[voice_num];
+	set_playing(voice_num, true);
+	voice_lanes.current_addr[voice_num] = voice.start_addr;
 	voice.is_high_nibble = false;
 	voice.current_byte = 0;
-	voice.output_pos = 0;
-	voice.prev_signal = 0;
-	voice.voice_signal = 0;
+	voice_lanes.output_pos[voice_num] = 0;
+	voice_lanes.prev_signal[voice_num] = 0;
+	voice_lanes.voice_signal[voice_num] = 0;
 	voice.voice_step = 127;
 	voice.adpcm_loop = false;
     }
 
-    void YMZ280B::key_off(ymcreative_voice &voice)
+    void YMZ280B::key_off(int voice_num)
     {
-	voice.is_playing = false;
+	set_playing(voice_num, false);
+    }
+
+    // Rather than checking for the end of each sample on every clock,
+    // the sample number at which a voice will reach its stop address is calculated
+    // whenever the voice's state is changed from outside of clockchip()
+    void YMZ280B::update_irq_event(int voice_num)
+    {
+	auto &voice = voices[voice_num];
+	irq_event_mask &= ~(1 << voice_num);
+
+	if (!voice.is_playing || testbit(voice_ended_mask, voice_num))
+	{
+	    return;
+	}
+
+	uint32_t addr = voice_lanes.current_addr[voice_num];
+	uint64_t num_fetches = 0;
+
+	switch (voice.mode)
+	{
+	    case 1:
+	    {
+		uint32_t stop_dist = ((voice.stop_addr - addr) & 0xFFFFFF);
+		uint32_t loop_dist = ((voice.loop_end_addr - addr) & 0xFFFFFF);
+
+		// Voice will loop forever before reaching the stop address
+		if (voice.is_looping && (loop_dist <= stop_dist))
+		{
+		    return;
+		}
+
+		// Both nibbles of the byte before the stop address are played,
+		// so the stop address is reached on the fetch after the last one
+		num_fetches = ((2 * uint64_t(stop_dist)) + 1 + voice.is_high_nibble);
+	    }
+	    break;
+	    case 2:
+	    case 3:
+	    {
+		if (addr > voice.stop_addr)
+		{
+		    return;
+		}
+
+		uint32_t bytes_per_sample = (voice.mode == 3) ? 2 : 1;
+		uint32_t stop_dist = (voice.stop_addr - addr);
+
+		// 16-bit voices skip over stop addresses that aren't sample-aligned
+		if ((stop_dist % bytes_per_sample) != 0)
+		{
+		    return;
+		}
+
+		if (voice.is_looping && (voice.loop_end_addr >= addr) && (voice.loop_end_addr <= voice.stop_addr))
+		{
+		    if (((voice.loop_end_addr - addr) % bytes_per_sample) == 0)
+		    {
+			return;
+		    }
+		}
+
+		num_fetches = ((stop_dist / bytes_per_sample) + 1);
+	    }
+	    break;
+	    default: return; break;
+	}
+
+	// A new sample is fetched each time output_pos crosses a multiple of (1 << pos_bits)
+	uint32_t output_step = voice_lanes.output_step[voice_num];
+	uint64_t distance = ((num_fetches << pos_bits) - voice_lanes.output_pos[voice_num]);
+	uint64_t num_clocks = ((distance + output_step - 1) / output_step);
+
+	irq_events[voice_num] = (sample_count + num_clocks);
+	irq_event_mask |= (1 << voice_num);
+    }
+
+    void YMZ280B::update_irq_status()
+    {
+	if (irq_event_mask == 0)
+	{
+	    return;
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+	    if (testbit(irq_event_mask, i) && (irq_events[i] <= sample_count))
+	    {
+		irq_event_mask &= ~(1 << i);
+		voice_ended_mask |= (1 << i);
+		irq_status |= (1 << i);
+	    }
+	}
+    }
+
+    bool YMZ280B::irq_line()
+    {
+	update_irq_status();
+	return (irq_enable && ((irq_status & irq_mask) != 0));
+    }
+
+    int64_t YMZ280B::samples_until_irq()
+    {
+	if (!irq_enable)
+	{
+	    return -1;
+	}
+
+	if (irq_line())
+	{
+	    return 0;
+	}
+
+	int64_t num_samples = -1;
+
+	for (int i = 0; i < 8; i++)
+	{
+	    if (testbit((irq_event_mask & irq_mask), i))
+	    {
+		int64_t voice_samples = (irq_events[i] - sample_count);
+
+		if ((num_samples < 0) || (voice_samples < num_samples))
+		{
+		    num_samples = voice_samples;
+		}
+	    }
+	}
+
+	return num_samples;
     }
 
     uint8_t YMZ280B::fetch_rom(uint32_t addr)
     {
 	addr &= 0xFFFFFF;
-	return (addr < ymz280b_rom.size()) ? ymz280b_rom.at(addr) : 0;
+	uint8_t *page = read_pages[(addr >> 12)];
+
+	if (page != nullptr)
+	{
+	    return page[(addr & 0xFFF)];
+	}
+
+	return read_unmapped(addr);
+    }
+
+    uint8_t YMZ280B::read_unmapped(uint32_t addr)
+    {
+	// Partial ROM pages (i.e. the end of a ROM whose size isn't
+	// a multiple of the page size) also end up here
+	if (!is_host_page[(addr >> 12)] && (addr < ymz280b_rom.size()))
+	{
+	    return ymz280b_rom[addr];
+	}
+
+	if (mem_read_func)
+	{
+	    return mem_read_func(addr);
+	}
+
+	return 0;
+    }
+
+    void YMZ280B::write_mem(uint32_t addr, uint8_t data)
+    {
+	addr &= 0xFFFFFF;
+	uint8_t *page = write_pages[(addr >> 12)];
+
+	if (page != nullptr)
+	{
+	    page[(addr & 0xFFF)] = data;
+	}
+	else if (mem_write_func)
+	{
+	    mem_write_func(addr, data);
+	}
+    }
+
+    void YMZ280B::map_rom_pages()
+    {
+	uint32_t num_rom_pages = (ymz280b_rom.size() >> 12);
+
+	for (uint32_t page = 0; page < 0x1000; page++)
+	{
+	    if (is_host_page[page])
+	    {
+		continue;
+	    }
+
+	    read_pages[page] = (page < num_rom_pages) ? &ymz280b_rom[(page << 12)] : nullptr;
+	    write_pages[page] = nullptr;
+	}
+    }
+
+    void YMZ280B::map_memory(uint32_t start_addr, uint32_t length, uint8_t *mem_ptr, bool is_writable)
+    {
+	if (((start_addr | length) & 0xFFF) != 0)
+	{
+	    throw runtime_error("YMZ280B memory regions must be aligned to 4 KB pages");
+	}
+
+	uint32_t start_page = ((start_addr >> 12) & 0xFFF);
+	uint32_t num_pages = min<uint32_t>((length >> 12), (0x1000 - start_page));
+
+	for (uint32_t i = 0; i < num_pages; i++)
+	{
+	    uint32_t page = (start_page + i);
+	    uint8_t *page_ptr = (mem_ptr != nullptr) ? (mem_ptr + (i << 12)) : nullptr;
+	    is_host_page[page] = (mem_ptr != nullptr);
+	    read_pages[page] = page_ptr;
+	    write_pages[page] = is_writable ? page_ptr : nullptr;
+	}
+
+	// Unmapped pages go back to the ROM (if it covers them)
+	if (mem_ptr == nullptr)
+	{
+	    map_rom_pages();
+	}
+    }
+
+    void YMZ280B::set_mem_handlers(ymzreadfunc read_func, ymzwritefunc write_func)
+    {
+	mem_read_func = read_func;
+	mem_write_func = write_func;
     }
 
-    void YMZ280B::generate_adpcm_sample(ymcreative_voice &voice)
+    void YMZ280B::write_ext_mem(const uint8_t *data, uint32_t length)
     {
-	if (!voice.is_playing)
+	if (!ext_mem_enable)
 	{
 	    return;
 	}
 
+	while (length > 0)
+	{
+	    uint32_t offset = (ext_mem_address & 0xFFF);
+	    uint32_t chunk_size = min<uint32_t>(length, (0x1000 - offset));
+	    uint8_t *page = write_pages[(ext_mem_address >> 12)];
+
+	    if (page != nullptr)
+	    {
+		memcpy((page + offset), data, chunk_size);
+	    }
+	    else if (mem_write_func)
+	    {
+		for (uint32_t i = 0; i < chunk_size; i++)
+		{
+		    mem_write_func((ext_mem_address + i), data[i]);
+		}
+	    }
+
+	    ext_mem_address = ((ext_mem_address + chunk_size) & 0xFFFFFF);
+	    data += chunk_size;
+	    length -= chunk_size;
+	}
+    }
+
+    void YMZ280B::generate_adpcm_sample(int voice_num)
+    {
+	auto &voice = voices[voice_num];
+	auto &current_addr = voice_lanes.current_addr[voice_num];
+	auto &prev_signal = voice_lanes.prev_signal[voice_num];
+	auto &voice_signal = voice_lanes.voice_signal[voice_num];
+
 	array<int, 8> adpcm_step_scale =
 	{
 	    230, 230, 230, 230,
@@ -130,18 +459,18 @@ namespace beepcm
 
 	if (voice.is_looping)
 	{
-	    if ((voice.current_addr == voice.loop_start_addr) && !voice.adpcm_loop)
+	    if ((current_addr == voice.loop_start_addr) && !voice.adpcm_loop)
 	    {
-		voice.loop_signal = voice.voice_signal;
+		voice.loop_signal = voice_signal;
 		voice.loop_step = voice.voice_step;
 	    }
 
-	    if (voice.current_addr == voice.loop_end_addr)
+	    if (current_addr == voice.loop_end_addr)
 	    {
 		if (voice.is_keyon)
 		{
-		    voice.current_addr = voice.loop_start_addr;
-		    voice.voice_signal = voice.loop_signal;
+		    current_addr = voice.loop_start_addr;
+		    voice_signal = voice.loop_signal;
 		    voice.voice_step = voice.loop_step;
 		    voice.is_high_nibble = false;
 		    voice.adpcm_loop = true;
@@ -149,23 +478,24 @@ namespace beepcm
 	    }
 	}
 
-	if (voice.current_addr == voice.stop_addr)
+	// The stop address is only checked between bytes, so that the low nibble of the last byte is still played
+	if ((current_addr == voice.stop_addr) && !voice.is_high_nibble)
 	{
-	    voice.prev_signal = 0;
-	    voice.voice_signal = 0;
+	    prev_signal = 0;
+	    voice_signal = 0;
 	    return;
 	}
 
 	if (!voice.is_high_nibble)
 	{
-	    voice.current_byte = fetch_rom(voice.current_addr++);
-	    voice.current_addr &= 0xFFFFFF;
+	    voice.current_byte = fetch_rom(current_addr++);
+	    current_addr &= 0xFFFFFF;
 	}
 
 	uint8_t data = (uint8_t(voice.current_byte << (4 * voice.is_high_nibble)) >> 4);
 	voice.is_high_nibble = !voice.is_high_nibble;
 
-	voice.prev_signal = voice.voice_signal;
+	prev_signal = voice_signal;
 
 	int32_t delta = (2 * (data & 0x7) + 1) * voice.voice_step / 8;
 
@@ -174,92 +504,111 @@ namespace beepcm
 	    delta = -delta;
 	}
 
-	voice.voice_signal = ((voice.voice_signal * 254) / 256);
-	voice.voice_signal = clamp((voice.voice_signal + delta), -32768, 32767);
+	voice_signal = ((voice_signal * 254) / 256);
+	voice_signal = clamp((voice_signal + delta), -32768, 32767);
 
 	int step_scale = adpcm_step_scale[(data & 0x7)];
 
 	voice.voice_step = clamp(((voice.voice_step * step_scale) >> 8), 127, 24576);
     }
 
-    void YMZ280B::generate_pcm8(ymcreative_voice &voice)
+    void YMZ280B::generate_pcm8(int voice_num)
     {
-	if (!voice.is_playing)
-	{
-	    return;
-	}
+	auto &voice = voices[voice_num];
+	auto &current_addr = voice_lanes.current_addr[voice_num];
 
 	if (voice.is_looping)
 	{
-	    if (voice.current_addr == voice.loop_end_addr)
+	    if (current_addr == voice.loop_end_addr)
 	    {
 		if (voice.is_keyon)
 		{
-		    voice.current_addr = voice.loop_start_addr;
+		    current_addr = voice.loop_start_addr;
 		}
 	    }
 	}
 
-	if (voice.current_addr == voice.stop_addr)
+	if (current_addr == voice.stop_addr)
 	{
-	    voice.prev_signal = 0;
-	    voice.voice_signal = 0;
+	    voice_lanes.prev_signal[voice_num] = 0;
+	    voice_lanes.voice_signal[voice_num] = 0;
 	    return;
 	}
 
-	voice.current_byte = fetch_rom(voice.current_addr++);
+	voice.current_byte = fetch_rom(current_addr++);
 
-	voice.prev_signal = voice.voice_signal;
-	voice.voice_signal = (int8_t(voice.current_byte) << 8);
+	voice_lanes.prev_signal[voice_num] = voice_lanes.voice_signal[voice_num];
+	voice_lanes.voice_signal[voice_num] = (int8_t(voice.current_byte) << 8);
     }
 
-    void YMZ280B::generate_pcm16(ymcreative_voice &voice)
+    void YMZ280B::generate_pcm16(int voice_num)
     {
-	if (!voice.is_playing)
-	{
-	    return;
-	}
+	auto &voice = voices[voice_num];
+	auto &current_addr = voice_lanes.current_addr[voice_num];
 
 	if (voice.is_looping)
 	{
-	    if (voice.current_addr == voice.loop_end_addr)
+	    if (current_addr == voice.loop_end_addr)
 	    {
 		if (voice.is_keyon)
 		{
-		    voice.current_addr = voice.loop_start_addr;
+		    current_addr = voice.loop_start_addr;
 		}
 	    }
 	}
 
-	if (voice.current_addr == voice.stop_addr)
+	if (current_addr == voice.stop_addr)
 	{
-	    voice.prev_signal = 0;
-	    voice.voice_signal = 0;
+	    voice_lanes.prev_signal[voice_num] = 0;
+	    voice_lanes.voice_signal[voice_num] = 0;
 	    return;
 	}
 
-	uint8_t low_byte = fetch_rom(voice.current_addr++);
-	uint8_t high_byte = fetch_rom(voice.current_addr++);
+	uint8_t low_byte = fetch_rom(current_addr++);
+	uint8_t high_byte = fetch_rom(current_addr++);
 
 	int16_t result = int16_t((high_byte << 8) | low_byte);
-	voice.prev_signal = voice.voice_signal;
-	voice.voice_signal = result;
+	voice_lanes.prev_signal[voice_num] = voice_lanes.voice_signal[voice_num];
+	voice_lanes.voice_signal[voice_num] = result;
     }
 
-    void YMZ280B::channel_output(ymcreative_voice &voice)
+    void YMZ280B::generate_sample(int voice_num)
     {
-	auto m_prev_accum = voice.prev_signal;
-	auto m_position = voice.output_pos;
-	auto m_accum = voice.voice_signal;
+	switch (voices[voice_num].mode)
+	{
+	    case 1: generate_adpcm_sample(voice_num); break;
+	    case 2: generate_pcm8(voice_num); break;
+	    case 3: generate_pcm16(voice_num); break;
+	    default: break;
+	}
+    }
+
+    // Interpolates between the previous and current signals of every voice
+    // whose lane in update_lanes is set to 1, with all eight voices being processed at once
+    void YMZ280B::channel_output(const array<uint32_t, 8> &update_lanes)
+    {
+	auto &lanes = voice_lanes;
+	uint32_t pos_shift = (pos_bits - 9);
 
-	int32_t result = (((m_prev_accum * int32_t((m_position ^ 0x1FF) + 1)) + (m_accum * int32_t(m_position))) >> 9);
+	for (int i = 0; i < 8; i++)
+	{
+	    int32_t m_position = (lanes.output_pos[i] >> pos_shift);
+	    int32_t result = (((lanes.prev_signal[i] * (0x200 - m_position)) + (lanes.voice_signal[i] * m_position)) >> 9);
+
+	    int32_t left = ((result * lanes.output_left[i]) >> 9);
+	    int32_t right = ((result * lanes.output_right[i]) >> 9);
 
-	voice.output[0] = ((result * int32_t(voice.output_left)) >> 9);
-	voice.output[1] = ((result * int32_t(voice.output_right)) >> 9);
+	    int32_t update_mask = -int32_t(update_lanes[i]);
+	    lanes.output[0][i] = ((left & update_mask) | (lanes.output[0][i] & ~update_mask));
+	    lanes.output[1][i] = ((right & update_mask) | (lanes.output[1][i] & ~update_mask));
+	}
     }
 
     void YMZ280B::writereg(uint8_t reg, uint8_t data)
     {
+	// Latch any IRQs that would have occurred before this write
+	update_irq_status();
+
 	if (reg < 0x80)
 	{
 	    int voice_num = ((reg >> 2) & 0x7);
@@ -271,7 +620,7 @@ namespace beepcm
 		case 0x00:
 		{
 		    voice.freq_num = ((voice.freq_num & 0x100) | data);
-		    update_step(voice);
+		    update_step(voice_num);
 		}
 		break;
 		case 0x01:
@@ -280,6 +629,13 @@ namespace beepcm
 		    voice.is_looping = testbit(data, 4);
 		    voice.mode = ((data & 0x60) >> 5);
 
+		    for (int mode = 0; mode < 4; mode++)
+		    {
+			mode_masks[mode] &= ~(1 << voice_num);
+		    }
+
+		    mode_masks[voice.mode] |= (1 << voice_num);
+
 		    bool is_keyon_val = false;
 
 		    if (voice.mode != 0)
@@ -289,27 +645,28 @@ namespace beepcm
 
 		    if (!voice.is_keyon && is_keyon_val && master_keyon)
 		    {
-			key_on(voice);
+			key_on(voice_num);
+			voice_ended_mask &= ~(1 << voice_num);
 		    }
 		    else if (voice.is_keyon && !is_keyon_val)
 		    {
-			key_off(voice);
+			key_off(voice_num);
 		    }
 
 		    voice.is_keyon = is_keyon_val;
-		    update_step(voice);
+		    update_step(voice_num);
 		}
 		break;
 		case 0x02:
 		{
 		    voice.level = data;
-		    update_volumes(voice);
+		    update_volumes(voice_num);
 		}
 		break;
 		case 0x03:
 		{
 		    voice.pan = (data & 0xF);
-		    update_volumes(voice);
+		    update_volumes(voice_num);
 		}
 		break;
 		case 0x20:
@@ -381,6 +738,8 @@ namespace beepcm
 		}
 		break;
 	    }
+
+	    update_irq_event(voice_num);
 	}
 	else
 	{
@@ -392,38 +751,48 @@ namespace beepcm
 		case 0x82: break;
 		case 0x84:
 		{
-		    cout << "Writing to ROM readback / RAM write bits 23-16" << endl;
+		    ext_mem_addr_hi = (data << 16);
 		}
 		break;
 		case 0x85:
 		{
-		    cout << "Writing to ROM readback / RAM write bits 15-8" << endl;
+		    ext_mem_addr_mid = (data << 8);
 		}
 		break;
 		case 0x86:
 		{
-		    cout << "Writing to ROM readback / RAM write bits 7-0" << endl;
+		    ext_mem_address = (ext_mem_addr_hi | ext_mem_addr_mid | data);
+
+		    if (ext_mem_enable)
+		    {
+			ext_read_latch = fetch_rom(ext_mem_address);
+		    }
 		}
 		break;
 		case 0x87:
 		{
-		    cout << "Writing to ROM readback / RAM write data port" << endl;
+		    if (ext_mem_enable)
+		    {
+			write_mem(ext_mem_address, data);
+			ext_mem_address = ((ext_mem_address + 1) & 0xFFFFFF);
+		    }
 		}
 		break;
 		case 0xFE:
 		{
-		    cout << "Updating IRQ state" << endl;
+		    irq_mask = data;
 		}
 		break;
 		case 0xFF:
 		{
-		    cout << "Writing to IRQ enable/memory enable/test register" << endl;
+		    irq_enable = testbit(data, 4);
+		    ext_mem_enable = testbit(data, 6);
 
 		    if (master_keyon && !testbit(data, 7))
 		    {
 			for (int i = 0; i < 8; i++)
 			{
-			    voices[i].is_playing = false;
+			    set_playing(i, false);
 			}
 		    }
 		    else if (!master_keyon && testbit(data, 7))
@@ -432,12 +801,17 @@ namespace beepcm
 			{
 			    if (voices[i].is_keyon)
 			    {
-				voices[i].is_playing = true;
+				set_playing(i, true);
 			    }
 			}
 		    }
 
 		    master_keyon = testbit(data, 7);
+
+		    for (int i = 0; i < 8; i++)
+		    {
+			update_irq_event(i);
+		    }
 		}
 		break;
 		default:
@@ -454,10 +828,43 @@ namespace beepcm
 
     uint32_t YMZ280B::get_sample_rate(uint32_t clock_rate)
     {
+	if (output_rate != 0)
+	{
+	    return output_rate;
+	}
+
 	// Internal clock rate is (clock / 384) * 2
 	return (clock_rate / 192.0);
     }
 
+    void YMZ280B::set_output_rate(uint32_t clock_rate, uint32_t output_rate)
+    {
+	if ((output_rate != 0) && ((uint64_t(output_rate) * 64 * 192) < clock_rate))
+	{
+	    throw runtime_error("YMZ280B output rate is too low for this clock rate");
+	}
+
+	// Latch any IRQs that would have occurred at the old rate
+	update_irq_status();
+
+	uint32_t old_pos_bits = pos_bits;
+	chip_clock_rate = clock_rate;
+	this->output_rate = output_rate;
+	pos_bits = (output_rate != 0) ? 25 : 9;
+
+	for (int i = 0; i < 8; i++)
+	{
+	    uint32_t position = voice_lanes.output_pos[i];
+	    voice_lanes.output_pos[i] = (pos_bits > old_pos_bits) ? (position << (pos_bits - old_pos_bits)) : (position >> (old_pos_bits - pos_bits));
+	    update_step(i);
+
+	    if (testbit(irq_event_mask, i))
+	    {
+		update_irq_event(i);
+	    }
+	}
+    }
+
     void YMZ280B::init()
     {
 	reset();
@@ -465,10 +872,22 @@ namespace beepcm
 
     void YMZ280B::reset()
     {
-	for (auto &voice : voices)
-	{
-	    voice.output.fill(0);
-	}
+	voice_lanes.output[0].fill(0);
+	voice_lanes.output[1].fill(0);
+
+	irq_enable = false;
+	irq_mask = 0;
+	irq_status = 0;
+	sample_count = 0;
+	irq_event_mask = 0;
+	voice_ended_mask = 0;
+	irq_events.fill(0);
+
+	ext_mem_enable = false;
+	ext_mem_addr_hi = 0;
+	ext_mem_addr_mid = 0;
+	ext_mem_address = 0;
+	ext_read_latch = 0;
     }
 
     void YMZ280B::writeIO(int port, uint8_t data)
@@ -483,8 +902,35 @@ namespace beepcm
 	}
     }
 
+    uint8_t YMZ280B::readIO(int port)
+    {
+	if ((port & 1) == 0)
+	{
+	    if (!ext_mem_enable)
+	    {
+		return 0xFF;
+	    }
+
+	    // Reading the readback port refills the latch from the current address
+	    // before advancing it (matching MAME's ordering)
+	    uint8_t data = ext_read_latch;
+	    ext_read_latch = fetch_rom(ext_mem_address);
+	    ext_mem_address = ((ext_mem_address + 1) & 0xFFFFFF);
+	    return data;
+	}
+
+	update_irq_status();
+
+	// Reading the status register clears it
+	uint8_t status = irq_status;
+	irq_status = 0;
+	return status;
+    }
+
     void YMZ280B::writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data)
     {
+	rom_hash.invalidate();
+
 	uint32_t vec_size = ymz280b_rom.size();
 
 	if (vec_size != rom_size)
@@ -492,6 +938,8 @@ namespace beepcm
 	    ymz280b_rom.resize(rom_size, 0xFF);
 	}
 
+	map_rom_pages();
+
 	if (data_start > rom_size)
 	{
 	    return;
@@ -509,54 +957,234 @@ namespace beepcm
 
     void YMZ280B::clockchip()
     {
+	sample_count += 1;
+
+	if ((snapshot_interval != 0) && (--snapshot_countdown == 0))
+	{
+	    publish_snapshot();
+	    snapshot_countdown = snapshot_interval;
+	}
+
+	if (playing_mask == 0)
+	{
+	    return;
+	}
+
+	auto &lanes = voice_lanes;
+
+	// Advance the output position of all playing voices at once
+	array<uint32_t, 8> carry;
+
+	uint32_t pos_mask = ((1 << pos_bits) - 1);
+
 	for (int i = 0; i < 8; i++)
 	{
-	    auto &voice = voices[i];
+	    uint32_t position = (lanes.output_pos[i] + (lanes.output_step[i] & lanes.active_mask[i]));
+	    lanes.output_pos[i] = (position & pos_mask);
+	    carry[i] = (position >> pos_bits);
+	}
+
+	uint8_t fetch_mask = 0;
+
+	if (output_rate == 0)
+	{
+	    for (int i = 0; i < 8; i++)
+	    {
+		fetch_mask |= (carry[i] << i);
+	    }
 
-	    if (!voice.is_playing)
+	    if (fetch_mask == 0)
 	    {
-		continue;
+		return;
+	    }
+	}
+	else
+	{
+	    // Below the chip's own rate, a voice can move on by more than one sample per clock,
+	    // in which case all but the last of them are decoded and skipped over here
+	    for (int i = 0; i < 8; i++)
+	    {
+		for (uint32_t skipped = 1; skipped < carry[i]; skipped++)
+		{
+		    generate_sample(i);
+		}
+
+		fetch_mask |= ((carry[i] != 0) << i);
 	    }
+	}
 
-	    uint32_t position = (voice.output_pos + voice.output_step);
-	    voice.output_pos = (position & 0x1FF);
+	// Fetch new samples for each group of voices,
+	// so that there's no need to switch on the mode of each voice
+	uint8_t adpcm_voices = (fetch_mask & mode_masks[1]);
+	uint8_t pcm8_voices = (fetch_mask & mode_masks[2]);
+	uint8_t pcm16_voices = (fetch_mask & mode_masks[3]);
 
-	    if (position < 0x200)
+	for (int i = 0; (adpcm_voices != 0) && (i < 8); i++)
+	{
+	    if (testbit(adpcm_voices, i))
 	    {
-		continue;
+		generate_adpcm_sample(i);
+	    }
+	}
+
+	for (int i = 0; (pcm8_voices != 0) && (i < 8); i++)
+	{
+	    if (testbit(pcm8_voices, i))
+	    {
+		generate_pcm8(i);
 	    }
+	}
 
-	    switch (voice.mode)
+	for (int i = 0; (pcm16_voices != 0) && (i < 8); i++)
+	{
+	    if (testbit(pcm16_voices, i))
 	    {
-		case 1: generate_adpcm_sample(voice); break;
-		case 2: generate_pcm8(voice); break;
-		case 3: generate_pcm16(voice); break;
+		generate_pcm16(i);
 	    }
+	}
+
+	if (output_rate == 0)
+	{
+	    channel_output(carry);
+	    return;
+	}
+
+	// Every clock is an output sample here, so every playing voice is interpolated on every clock
+	array<uint32_t, 8> update_lanes;
 
-	    channel_output(voice);
+	for (int i = 0; i < 8; i++)
+	{
+	    update_lanes[i] = (lanes.active_mask[i] & 1);
 	}
+
+	channel_output(update_lanes);
+    }
+
+    ymcreative_debug YMZ280B::get_debug()
+    {
+	ymcreative_debug debug;
+	debug.master_keyon = master_keyon;
+
+	for (int i = 0; i < 8; i++)
+	{
+	    auto &voice = debug.voices[i];
+	    static_cast<ymcreative_voice&>(voice) = voices[i];
+	    voice.output_pos = voice_lanes.output_pos[i];
+	    voice.output_step = voice_lanes.output_step[i];
+	    voice.current_addr = voice_lanes.current_addr[i];
+	    voice.prev_signal = voice_lanes.prev_signal[i];
+	    voice.voice_signal = voice_lanes.voice_signal[i];
+	    voice.output_left = voice_lanes.output_left[i];
+	    voice.output_right = voice_lanes.output_right[i];
+	    voice.output[0] = voice_lanes.output[0][i];
+	    voice.output[1] = voice_lanes.output[1][i];
+	}
+
+	return debug;
+    }
+
+    ymcreative_snapshot YMZ280B::get_snapshot() const
+    {
+	return snapshot_lock.read();
+    }
+
+    void YMZ280B::publish_snapshot()
+    {
+	ymcreative_snapshot snapshot;
+	snapshot.master_keyon = master_keyon;
+	snapshot.sample_count = sample_count;
+
+	for (int i = 0; i < 8; i++)
+	{
+	    auto &status = snapshot.voices[i];
+	    status.is_playing = voices[i].is_playing;
+	    status.level = voices[i].level;
+	    status.pan = voices[i].pan;
+	    status.current_addr = voice_lanes.current_addr[i];
+	    status.current_signal = voice_lanes.voice_signal[i];
+	}
+
+	snapshot_lock.publish(snapshot);
+    }
+
+    void YMZ280B::set_snapshot_interval(uint32_t num_samples)
+    {
+	snapshot_interval = num_samples;
+	snapshot_countdown = num_samples;
     }
 
     vector<int32_t> YMZ280B::get_samples()
     {
-	vector<int32_t> final_samples;
+	vector<int32_t> final_samples(2, 0);
+	get_samples(final_samples.data());
+	return final_samples;
+    }
+
+    void YMZ280B::get_samples(int32_t *samples)
+    {
 	array<int32_t, 2> mixed_samples = {0, 0};
 
-	for (auto &voice : voices)
+	for (int voice_num = 0; voice_num < 8; voice_num++)
 	{
 	    for (int i = 0; i < 2; i++)
 	    {
 		int32_t old_sample = mixed_samples[i];
-		int32_t new_sample = clamp<int16_t>(voice.output[i], -32768, 32767);
+		int32_t new_sample = clamp<int16_t>(voice_lanes.output[i][voice_num], -32768, 32767);
 
 		int32_t result = (old_sample + new_sample);
 		mixed_samples[i] = clamp(result, -32768, 32767);
 	    }
 	}
 
-	final_samples.push_back(mixed_samples[0]);
-	final_samples.push_back(mixed_samples[1]);
+	samples[0] = mixed_samples[0];
+	samples[1] = mixed_samples[1];
+    }
 
-	return final_samples;
+    template<typename State>
+    void YMZ280B::sync_state(State &state)
+    {
+	state.sync(chip_address);
+	state.sync(master_keyon);
+	state.sync(voices);
+	state.sync(voice_lanes);
+	state.sync(playing_mask);
+	state.sync(mode_masks);
+	state.sync(snapshot_countdown);
+	state.sync(irq_enable);
+	state.sync(irq_mask);
+	state.sync(irq_status);
+	state.sync(sample_count);
+	state.sync(irq_event_mask);
+	state.sync(voice_ended_mask);
+	state.sync(irq_events);
+	state.sync(chip_clock_rate);
+	state.sync(output_rate);
+	state.sync(pos_bits);
+	state.sync(ext_mem_enable);
+	state.sync(ext_mem_addr_hi);
+	state.sync(ext_mem_addr_mid);
+	state.sync(ext_mem_address);
+	state.sync(ext_read_latch);
+    }
+
+    vector<uint8_t> YMZ280B::save_state()
+    {
+	vector<uint8_t> state;
+	save_state(state);
+	return state;
+    }
+
+    void YMZ280B::save_state(vector<uint8_t> &state)
+    {
+	StateWriter writer("YMZB", state_version, rom_hash.get_hash(ymz280b_rom), move(state));
+	sync_state(writer);
+	state = writer.get_state();
+    }
+
+    void YMZ280B::load_state(const vector<uint8_t> &state)
+    {
+	StateReader reader(state, "YMZB", state_version, rom_hash.get_hash(ymz280b_rom));
+	sync_state(reader);
+	reader.finish();
     }
 };
\ No newline at end of file
@@ -21,10 +21,14 @@
 
 #include <iostream>
 #include <algorithm>
+#include <functional>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <cmath>
 #include <array>
 #include <vector>
+#include "savestate.h"
 using namespace std;
 
 namespace beepcm
@@ -42,53 +46,140 @@ namespace beepcm
 	uint8_t level = 0;
 
 	int pan = 0;
-	int output_left = 0;
-	int output_right = 0;
 
 	uint32_t start_addr = 0;
 	uint32_t loop_start_addr = 0;
 	uint32_t loop_end_addr = 0;
 	uint32_t stop_addr = 0;
 
-	uint32_t current_addr = 0;
-	uint32_t output_step = 0;
-
 	bool is_high_nibble = false;
 	uint8_t current_byte = 0;
-	uint32_t output_pos = 0;
-	int32_t prev_signal = 0;
 	int32_t voice_step = 0;
-	int32_t voice_signal = 0;
 	int32_t loop_signal = 0;
 	int32_t loop_step = 0;
-	array<int32_t, 2> output;
+    };
+
+    // A voice's registers and decoder state, along with its per-sample state
+    // (which the chip keeps in its voice lanes rather than in ymcreative_voice)
+    struct ymcreative_debug_voice : ymcreative_voice
+    {
+	int output_left = 0;
+	int output_right = 0;
+	uint32_t current_addr = 0;
+	uint32_t output_step = 0;
+	uint32_t output_pos = 0;
+	int32_t prev_signal = 0;
+	int32_t voice_signal = 0;
+	array<int32_t, 2> output = {0, 0};
     };
 
     struct ymcreative_debug
     {
-	array<ymcreative_voice, 8> voices;
+	array<ymcreative_debug_voice, 8> voices;
 	bool master_keyon = false;
 
-	ymcreative_voice get_voice(int channel)
+	ymcreative_debug_voice get_voice(int channel)
 	{
 	    channel &= 7;
 	    return voices.at(channel);
 	}
     };
 
+    // Compact per-voice state published for visualizers
+    struct ymcreative_voice_status
+    {
+	bool is_playing = false;
+	uint8_t level = 0;
+	uint8_t pan = 0;
+	uint32_t current_addr = 0;
+	int32_t current_signal = 0;
+    };
+
+    struct ymcreative_snapshot
+    {
+	array<ymcreative_voice_status, 8> voices;
+	bool master_keyon = false;
+	uint64_t sample_count = 0;
+    };
+
+    // Sequence lock that lets one thread (i.e. the audio thread) publish snapshots
+    // that any number of other threads can read without locking,
+    // retrying only if a read overlaps with a write
+    class ymcreative_snapshot_lock
+    {
+	public:
+	    ymcreative_snapshot_lock();
+	    ymcreative_snapshot_lock(const ymcreative_snapshot_lock&) = delete;
+	    ymcreative_snapshot_lock &operator=(const ymcreative_snapshot_lock&) = delete;
+
+	    void publish(const ymcreative_snapshot &snapshot);
+	    ymcreative_snapshot read() const;
+
+	private:
+	    static constexpr size_t num_words = ((sizeof(ymcreative_snapshot) + 3) / 4);
+
+	    atomic<uint32_t> sequence;
+	    array<atomic<uint32_t>, num_words> words;
+    };
+
+    using ymzreadfunc = function<uint8_t(uint32_t)>;
+    using ymzwritefunc = function<void(uint32_t, uint8_t)>;
+
     class YMZ280B
     {
 	public:
 	    YMZ280B();
 	    ~YMZ280B();
 
+	    // The memory page tables point into this chip's ROM, so copying a chip isn't allowed
+	    // (use save_state() and load_state() on another chip with the same ROM instead)
+	    YMZ280B(const YMZ280B&) = delete;
+	    YMZ280B &operator=(const YMZ280B&) = delete;
+
 	    uint32_t get_sample_rate(uint32_t clock_rate);
 	    void init();
+
+	    // Clocks the chip once per sample at output_rate instead of at its own sample rate (clock_rate / 192),
+	    // with each voice stepping through its samples at the matching rate
+	    // (so no further resampling is needed), or goes back to the chip's own rate if output_rate is 0.
+	    // While this is set, get_sample_rate() returns output_rate and samples_until_irq() counts output samples
+	    void set_output_rate(uint32_t clock_rate, uint32_t output_rate);
 	    void writeIO(int port, uint8_t data);
+	    uint8_t readIO(int port);
 	    void writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data);
 	    void clockchip();
 	    vector<int32_t> get_samples();
 
+	    // Same as above, but writes the left and right samples to samples[0] and samples[1]
+	    void get_samples(int32_t *samples);
+
+	    // Saves the voice, IRQ and external memory state, along with the output rate
+	    // (with the ROM only being identified by its hash, and memory mappings and handlers not being saved),
+	    // and loads a state saved by a YMZ280B with the same ROM
+	    vector<uint8_t> save_state();
+	    void load_state(const vector<uint8_t> &state);
+
+	    // Same as save_state(), but reuses the storage of state,
+	    // so that a state can be saved every frame (e.g. for run-ahead) without allocating
+	    void save_state(vector<uint8_t> &state);
+
+	    // Maps a page-aligned region of external memory directly to mem_ptr, bypassing the memory handlers
+	    // (or unmaps it if mem_ptr is null, so that it falls back to the ROM and then the memory handlers)
+	    void map_memory(uint32_t start_addr, uint32_t length, uint8_t *mem_ptr, bool is_writable);
+
+	    // Handlers for accesses to unmapped regions of external memory
+	    void set_mem_handlers(ymzreadfunc read_func, ymzwritefunc write_func);
+
+	    // Equivalent to writing each byte of data to the RAM write data port (0x87)
+	    void write_ext_mem(const uint8_t *data, uint32_t length);
+
+	    // Returns the current state of the IRQ line
+	    bool irq_line();
+
+	    // Returns the number of samples until the IRQ line will be asserted
+	    // (0 if it is already asserted), or -1 if no IRQ is currently pending
+	    int64_t samples_until_irq();
+
 	    void writeROM(vector<uint8_t> rom_data)
 	    {
 		writeROM(rom_data.size(), 0, rom_data.size(), rom_data);
@@ -100,13 +191,16 @@ namespace beepcm
 		writeROM(rom_data);
 	    }
 
-	    ymcreative_debug get_debug()
-	    {
-		ymcreative_debug debug;
-		debug.voices = voices;
-		debug.master_keyon = master_keyon;
-		return debug;
-	    }
+	    ymcreative_debug get_debug();
+
+	    // Returns the most recently published snapshot of the chip's state
+	    // (safe to call from any thread while the chip is being clocked)
+	    ymcreative_snapshot get_snapshot() const;
+
+	    // Publishes a snapshot of the chip's state, which is also done
+	    // automatically every snapshot_interval samples (0 disables this)
+	    void publish_snapshot();
+	    void set_snapshot_interval(uint32_t num_samples);
 
 	private:
 	    template<typename T>
@@ -117,28 +211,103 @@ namespace beepcm
 
 	    void reset();
 
+	    static constexpr uint32_t state_version = 2;
+	    rom_hash_cache rom_hash;
+
+	    template<typename State>
+	    void sync_state(State &state);
+
 	    uint8_t chip_address = 0;
 
 	    void writereg(uint8_t reg, uint8_t data);
 
 	    bool master_keyon = false;
 
+	    // Register and ADPCM decoder state of each voice
+	    // (the per-sample fields are kept in voice_lanes instead)
 	    array<ymcreative_voice, 8> voices;
 
-	    void update_step(ymcreative_voice &voice);
-	    void update_volumes(ymcreative_voice &voice);
-
-	    void key_on(ymcreative_voice &voice);
-	    void key_off(ymcreative_voice &voice);
-
-	    void channel_output(ymcreative_voice &voice);
-	    void generate_adpcm_sample(ymcreative_voice &voice);
-	    void generate_pcm8(ymcreative_voice &voice);
-	    void generate_pcm16(ymcreative_voice &voice);
+	    // Per-sample voice state, laid out as a structure of arrays
+	    // so that clockchip() can process all eight voices in SIMD lanes
+	    struct alignas(32) ymcreative_lanes
+	    {
+		array<uint32_t, 8> output_pos = {};
+		array<uint32_t, 8> output_step = {};
+		array<uint32_t, 8> active_mask = {};
+		array<uint32_t, 8> current_addr = {};
+		array<int32_t, 8> prev_signal = {};
+		array<int32_t, 8> voice_signal = {};
+		array<int32_t, 8> output_left = {};
+		array<int32_t, 8> output_right = {};
+		array<array<int32_t, 8>, 2> output = {};
+	    };
+
+	    ymcreative_lanes voice_lanes;
+
+	    // Bitmasks of the voices that are playing and of the voices set to each mode
+	    uint8_t playing_mask = 0;
+	    array<uint8_t, 4> mode_masks = {};
+
+	    void set_playing(int voice_num, bool is_playing);
+
+	    ymcreative_snapshot_lock snapshot_lock;
+	    uint32_t snapshot_interval = 512;
+	    uint32_t snapshot_countdown = 512;
+
+	    bool irq_enable = false;
+	    uint8_t irq_mask = 0;
+	    uint8_t irq_status = 0;
+
+	    // Sample number at which each voice will reach its stop address,
+	    // only valid if the voice's bit is set in irq_event_mask
+	    uint64_t sample_count = 0;
+	    uint8_t irq_event_mask = 0;
+	    uint8_t voice_ended_mask = 0;
+	    array<uint64_t, 8> irq_events;
+
+	    void update_irq_event(int voice_num);
+	    void update_irq_status();
+
+	    // Output rate and number of fractional bits in each voice's output_pos
+	    // (9 at the chip's own rate, with 16 more bits of precision at other rates)
+	    uint32_t chip_clock_rate = 0;
+	    uint32_t output_rate = 0;
+	    uint32_t pos_bits = 9;
+
+	    void update_step(int voice_num);
+	    void update_volumes(int voice_num);
+
+	    void key_on(int voice_num);
+	    void key_off(int voice_num);
+
+	    void channel_output(const array<uint32_t, 8> &update_lanes);
+	    void generate_adpcm_sample(int voice_num);
+	    void generate_pcm8(int voice_num);
+	    void generate_pcm16(int voice_num);
+	    void generate_sample(int voice_num);
 
 	    uint8_t fetch_rom(uint32_t addr);
+	    uint8_t read_unmapped(uint32_t addr);
+	    void write_mem(uint32_t addr, uint8_t data);
 
 	    vector<uint8_t> ymz280b_rom;
+
+	    bool ext_mem_enable = false;
+	    uint32_t ext_mem_addr_hi = 0;
+	    uint32_t ext_mem_addr_mid = 0;
+	    uint32_t ext_mem_address = 0;
+	    uint8_t ext_read_latch = 0;
+
+	    // External memory is split into 4 KB pages, each of which either
+	    // points directly at ROM/RAM or falls back to the memory handlers
+	    array<uint8_t*, 0x1000> read_pages = {};
+	    array<uint8_t*, 0x1000> write_pages = {};
+	    array<bool, 0x1000> is_host_page = {};
+
+	    ymzreadfunc mem_read_func;
+	    ymzwritefunc mem_write_func;
+
+	    void map_rom_pages();
     };
 };
 
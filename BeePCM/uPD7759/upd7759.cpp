@@ -331,6 +331,8 @@ namespace beepcm
 
     void uPD7759::writeROM(uint32_t rom_size, uint32_t data_start, uint32_t data_len, vector<uint8_t> rom_data)
     {
+	rom_hash.invalidate();
+
 	speech_rom.resize(rom_size, 0xFF);
 
 	uint32_t data_length = data_len;
@@ -385,8 +387,64 @@ namespace beepcm
 
     vector<int32_t> uPD7759::get_samples()
     {
-	vector<int32_t> samples;
-	samples.push_back(output_sample);
-	return samples;
+	vector<int32_t> final_samples(1, 0);
+	get_samples(final_samples.data());
+	return final_samples;
+    }
+
+    void uPD7759::get_samples(int32_t *samples)
+    {
+	samples[0] = output_sample;
+    }
+
+    template<typename State>
+    void uPD7759::sync_state(State &state)
+    {
+	state.sync(is_reset);
+	state.sync(is_start);
+	state.sync(this->state);
+	state.sync(drq_state);
+	state.sync(position);
+	state.sync(step);
+	state.sync(clocks_left);
+	state.sync(drq_clocks);
+	state.sync(clock_period);
+	state.sync(requested_sample);
+	state.sync(last_sample);
+	state.sync(offset);
+	state.sync(output_sample);
+	state.sync(is_valid_header);
+	state.sync(block_header);
+	state.sync(sample_rate);
+	state.sync(nibbles_left);
+	state.sync(repeat_count);
+	state.sync(repeat_offset);
+	state.sync(adpcm_data);
+	state.sync(fifo_in);
+	state.sync(is_drq);
+	state.sync(adpcm_state);
+	state.sync(adpcm_sample);
+	state.sync(prev_sample);
+    }
+
+    vector<uint8_t> uPD7759::save_state()
+    {
+	vector<uint8_t> state;
+	save_state(state);
+	return state;
+    }
+
+    void uPD7759::save_state(vector<uint8_t> &state)
+    {
+	StateWriter writer("7759", state_version, rom_hash.get_hash(speech_rom), move(state));
+	sync_state(writer);
+	state = writer.get_state();
+    }
+
+    void uPD7759::load_state(const vector<uint8_t> &state)
+    {
+	StateReader reader(state, "7759", state_version, rom_hash.get_hash(speech_rom));
+	sync_state(reader);
+	reader.finish();
     }
 };
\ No newline at end of file
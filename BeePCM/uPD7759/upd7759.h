@@ -27,6 +27,7 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include "savestate.h"
 using namespace std;
 
 namespace beepcm
@@ -55,6 +56,18 @@ namespace beepcm
 	    void clock_chip();
 	    vector<int32_t> get_samples();
 
+	    // Same as above, but writes the sample to samples[0]
+	    void get_samples(int32_t *samples);
+
+	    // Saves the state machine and ADPCM decoder (with the ROM only being identified by its hash),
+	    // and loads a state saved by a uPD7759 with the same ROM
+	    vector<uint8_t> save_state();
+	    void load_state(const vector<uint8_t> &state);
+
+	    // Same as save_state(), but reuses the storage of state,
+	    // so that a state can be saved every frame (e.g. for run-ahead) without allocating
+	    void save_state(vector<uint8_t> &state);
+
 	private:
 	    template<typename T>
 	    bool testbit(T reg, int bit)
@@ -64,6 +77,12 @@ namespace beepcm
 
 	    void reset();
 
+	    static constexpr uint32_t state_version = 1;
+	    rom_hash_cache rom_hash;
+
+	    template<typename State>
+	    void sync_state(State &state);
+
 	    ofstream file;
 
 	    bool is_reset = false;